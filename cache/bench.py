@@ -0,0 +1,200 @@
+#!/usr/bin/env python3
+#
+# bench.py - Measures the speed of csim itself. It runs ./csim over a
+#     fixed matrix of traces and geometries several times each and
+#     reports references per second, ns per reference and peak RSS as
+#     the median over the runs with their spread. Results are written
+#     as JSON and compared against a baseline measured on the same host
+#     (make bench-baseline), so a change that slows down ref_mem() shows
+#     up as a regression. bench-reference.json is one such run, kept for
+#     reference; against another host's numbers differences only warn.
+#
+import json
+import optparse
+import os
+import platform
+import subprocess
+import sys
+import time
+
+# Synthetic traces, regenerated identically from a fixed seed
+SYNTH_TRACES = [
+    ("seq",     ["-p", "seq",     "-f", "64m"]),
+    ("uniform", ["-p", "uniform", "-f", "64m"]),
+    ("zipf",    ["-p", "zipf",    "-f", "64m"]),
+    ("chase",   ["-p", "chase",   "-f", "16m"]),
+    ("mixed",   ["-p", "mixed",   "-f", "64m", "-P", "256k"]),
+]
+
+# Geometries as (s, E, b): the lab's direct-mapped cache, a typical L1,
+# a wide L2 and a large highly associative LLC
+GEOMETRIES = [(5, 1, 5), (6, 8, 6), (10, 16, 6), (13, 32, 6)]
+
+#
+# countRefs - number of data references in a text trace
+#
+def countRefs(path):
+    n = 0
+    with open(path) as f:
+        for line in f:
+            if line[:2] in (" L", " S", " M"):
+                n += 1
+    return n
+
+#
+# makeTraces - generate the synthetic traces (once) and list every trace
+#     of the matrix as (name, path, data references)
+#
+def makeTraces(trace_dir, nrefs):
+    if not os.path.isdir(trace_dir):
+        os.makedirs(trace_dir)
+    traces = [("long", "traces/long.trace", countRefs("traces/long.trace"))]
+    for name, args in SYNTH_TRACES:
+        path = os.path.join(trace_dir, "%s-%d.trace" % (name, nrefs))
+        if not os.path.exists(path):
+            subprocess.check_call(["./synthgen", "-S", "42", "-n", str(nrefs),
+                                   "-o", path] + args)
+        traces.append((name, path, nrefs))
+    return traces
+
+#
+# runOnce - run csim once; returns (wall seconds, peak RSS in KB)
+#
+def runOnce(cmd):
+    with open(os.devnull, "w") as null:
+        start = time.perf_counter()
+        p = subprocess.Popen(cmd, stdout=null)
+        _, status, usage = os.wait4(p.pid, 0)
+        elapsed = time.perf_counter() - start
+    if status != 0:
+        sys.exit("bench.py: %s failed" % " ".join(cmd))
+    return elapsed, usage.ru_maxrss
+
+#
+# hostInfo - what the timings depend on: architecture, CPU model and count
+#
+def hostInfo():
+    cpu = platform.processor()
+    try:
+        with open("/proc/cpuinfo") as f:
+            for line in f:
+                if line.startswith("model name"):
+                    cpu = line.split(":", 1)[1].strip()
+                    break
+    except IOError:
+        pass
+    return {"machine": platform.machine(), "cpu": cpu, "cpus": os.cpu_count()}
+
+def median(values):
+    v = sorted(values)
+    mid = len(v) // 2
+    return v[mid] if len(v) % 2 else (v[mid - 1] + v[mid]) / 2.0
+
+#
+# runMatrix - every trace on every geometry, repeats times each
+#
+def runMatrix(traces, repeats, extra):
+    results = []
+    for name, path, nrefs in traces:
+        for s, E, b in GEOMETRIES:
+            cmd = ["./csim", "-s", str(s), "-E", str(E), "-b", str(b), "-t", path] + extra
+            runs = [runOnce(cmd) for _ in range(repeats)]
+            times = [t for t, _ in runs]
+            t = median(times)
+            results.append({
+                "trace": name,
+                "geometry": "%d,%d,%d" % (s, E, b),
+                "refs": nrefs,
+                "runs": repeats,
+                "seconds": t,
+                "spread": (max(times) - min(times)) / t if t > 0 else 0.0,
+                "refs_per_sec": nrefs / t if t > 0 else 0.0,
+                "ns_per_ref": t * 1e9 / nrefs if nrefs else 0.0,
+                "peak_rss_kb": max(rss for _, rss in runs),
+            })
+            r = results[-1]
+            print("%-8s %-9s %12.0f refs/s %8.2f ns/ref %8d KB  (+/-%.1f%%)" %
+                  (name, r["geometry"], r["refs_per_sec"], r["ns_per_ref"],
+                   r["peak_rss_kb"], 50 * r["spread"]))
+            sys.stdout.flush()
+    return results
+
+#
+# compare - report entries whose median ns/ref grew by more than threshold
+#     against the baseline; returns the number of regressions
+#
+def compare(results, baseline, threshold):
+    base = dict(((r["trace"], r["geometry"]), r) for r in baseline["results"])
+    regressions = 0
+    print("\nAgainst baseline (threshold %.0f%%):" % (100 * threshold))
+    for r in results:
+        old = base.get((r["trace"], r["geometry"]))
+        if old is None or old["ns_per_ref"] == 0:
+            continue
+        change = r["ns_per_ref"] / old["ns_per_ref"] - 1
+        flag = ""
+        if change > threshold:
+            flag = "  REGRESSION"
+            regressions += 1
+        print("%-8s %-9s %8.2f -> %8.2f ns/ref (%+.1f%%)%s" %
+              (r["trace"], r["geometry"], old["ns_per_ref"], r["ns_per_ref"],
+               100 * change, flag))
+    return regressions
+
+#
+# main - Main function
+#
+def main():
+    p = optparse.OptionParser()
+    p.add_option("-r", type="int", dest="repeats", default=5,
+                 help="runs per trace and geometry (default 5)")
+    p.add_option("-n", type="int", dest="nrefs", default=4000000,
+                 help="references per synthetic trace (default 4000000)")
+    p.add_option("-d", dest="trace_dir", default=".bench",
+                 help="where synthetic traces are kept (default .bench)")
+    p.add_option("-o", dest="output", default="bench-results.json",
+                 help="write results as JSON here")
+    p.add_option("-b", dest="baseline", default="bench-baseline.json",
+                 help="compare against this results file, \"\" for none "
+                 "(default bench-baseline.json, from make bench-baseline)")
+    p.add_option("-t", type="float", dest="threshold", default=0.05,
+                 help="slowdown reported as a regression (default 0.05)")
+    p.add_option("-x", dest="extra", default="",
+                 help="extra csim options, e.g. \"--fast-forward\"")
+    opts, args = p.parse_args()
+
+    # read before the run, since -o may overwrite the baseline itself
+    baseline = None
+    if opts.baseline:
+        if os.path.exists(opts.baseline):
+            with open(opts.baseline) as f:
+                baseline = json.load(f)
+        else:
+            print("bench.py: no baseline %s, not comparing; "
+                  "make bench-baseline measures one" % opts.baseline)
+
+    traces = makeTraces(opts.trace_dir, opts.nrefs)
+    extra = opts.extra.split()
+    host = hostInfo()
+    results = runMatrix(traces, opts.repeats, extra)
+    with open(opts.output, "w") as f:
+        json.dump({"host": host, "csim_options": extra, "results": results}, f, indent=2)
+    print("\nResults written to %s" % opts.output)
+
+    if baseline is not None:
+        if baseline.get("csim_options", []) != extra:
+            print("bench.py: baseline %s was run with csim options %s" %
+                  (opts.baseline, " ".join(baseline.get("csim_options", [])) or "(none)"))
+        regressions = compare(results, baseline, opts.threshold)
+        # wall-clock numbers from another machine only inform
+        if baseline.get("host") != host:
+            if regressions:
+                print("bench.py: baseline %s was measured on another host (%s), "
+                      "not failing" % (opts.baseline,
+                                       baseline.get("host", {}).get("cpu", "unknown")))
+        elif regressions:
+            sys.exit(1)
+
+# execute main only if called as a script
+if __name__ == "__main__":
+    main()
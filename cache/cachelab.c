@@ -5,11 +5,19 @@
 #include <stdlib.h>
 #include <assert.h>
 #include "cachelab.h"
+#include "cachesim.h"
 #include <time.h>
 
 trans_func_t func_list[MAX_TRANS_FUNCS];
 int func_counter = 0; 
 
+/* References recorded by the matrix accessors, see startCapture() */
+static csim_ref_t *capture_refs = NULL;
+static size_t capture_n = 0;
+static size_t capture_cap = 0;
+static int capturing = 0;
+static int capture_failed = 0;
+
 /* 
  * printSummary - Summarize the cache simulation statistics. Student cache simulators
  *                must call this function in order to be properly autograded. 
@@ -81,3 +89,83 @@ void registerTransFunction(void (*trans)(int M, int N, int[N][M], int[M][N]),
     func_list[func_counter].num_evictions =0;
     func_counter++;
 }
+
+/*
+ * capture - Record one access if a capture is in progress
+ */
+static void capture(const void *p, int size, char op)
+{
+    if (!capturing || capture_failed)
+        return;
+    if (capture_n == capture_cap) {
+        size_t cap = capture_cap ? 2 * capture_cap : 4096;
+        csim_ref_t *grown = realloc(capture_refs, cap * sizeof(csim_ref_t));
+        if (grown == NULL) {
+            capture_failed = 1;
+            return;
+        }
+        capture_refs = grown;
+        capture_cap = cap;
+    }
+    capture_refs[capture_n].address = (unsigned long long) p;
+    capture_refs[capture_n].op = op;
+    capture_refs[capture_n].size = size;
+    capture_n++;
+}
+
+/* 
+ * transLoad - TRANS_LOAD() in capture builds: read *p and record it
+ */
+int transLoad(int *p)
+{
+    capture(p, sizeof(int), 'L');
+    return *p;
+}
+
+/* 
+ * transStore - TRANS_STORE() in capture builds: write *p and record it
+ */
+void transStore(int *p, int v)
+{
+    capture(p, sizeof(int), 'S');
+    *p = v;
+}
+
+/* 
+ * transTouch - TRANS_TOUCH() in capture builds: record an access of size
+ *     bytes that does not go through the element accessors
+ */
+void transTouch(const void *p, int size, char op)
+{
+    capture(p, size, op);
+}
+
+/* 
+ * startCapture - Start recording the accesses made through TRANS_LOAD()
+ *     and TRANS_STORE() into a fresh buffer
+ */
+void startCapture(void)
+{
+    capture_refs = NULL;
+    capture_n = capture_cap = 0;
+    capture_failed = 0;
+    capturing = 1;
+}
+
+/* 
+ * stopCapture - Stop recording. Hands the buffer to the caller, who
+ *     frees it. Returns -1 if the buffer could not grow.
+ */
+int stopCapture(csim_ref_t **refs, size_t *n)
+{
+    capturing = 0;
+    if (capture_failed) {
+        free(capture_refs);
+        capture_refs = NULL;
+        return -1;
+    }
+    *refs = capture_refs;
+    *n = capture_n;
+    capture_refs = NULL;
+    return 0;
+}
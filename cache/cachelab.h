@@ -5,6 +5,10 @@
 #ifndef CACHELAB_TOOLS_H
 #define CACHELAB_TOOLS_H
 
+#include <stddef.h>
+
+struct csim_ref;  /* csim_ref_t, see cachesim.h */
+
 #define MAX_TRANS_FUNCS 100
 
 typedef struct trans_func{
@@ -34,4 +38,33 @@ void correctTrans(int M, int N, int A[N][M], int B[M][N]);
 void registerTransFunction(
     void (*trans)(int M,int N,int[N][M],int[M][N]), char* desc);
 
+/*
+ * Matrix element accessors for transpose functions. Built normally they
+ * are plain array references. Built with -DCSIM_CAPTURE (trans-capture.o)
+ * they also record each access between startCapture() and stopCapture(),
+ * so a transpose can be simulated in-process without Valgrind. The load
+ * is always recorded before the store that uses it.
+ */
+#ifdef CSIM_CAPTURE
+#define TRANS_LOAD(A, i, j) transLoad(&(A)[i][j])
+#define TRANS_STORE(B, i, j, v) transStore(&(B)[i][j], (v))
+#define TRANS_TOUCH(p, size, op) transTouch((p), (size), (op))
+#else
+#define TRANS_LOAD(A, i, j) ((A)[i][j])
+#define TRANS_STORE(B, i, j, v) ((B)[i][j] = (v))
+#define TRANS_TOUCH(p, size, op) ((void) 0)
+#endif
+
+int transLoad(int *p);
+void transStore(int *p, int v);
+
+/* Record a wider access, e.g. a vector load ('L') or store ('S') */
+void transTouch(const void *p, int size, char op);
+
+/* Start recording accesses made through the accessors */
+void startCapture(void);
+
+/* Stop recording and hand over the recorded references (free *refs) */
+int stopCapture(struct csim_ref **refs, size_t *n);
+
 #endif /* CACHELAB_TOOLS_H */
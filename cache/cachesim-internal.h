@@ -0,0 +1,354 @@
+/*
+ * cachesim-internal.h - Cache model types and functions shared by cachesim.c
+ * and csim's front end
+ *
+ * Not part of the csim_* interface: these change along with csim.
+ */
+#ifndef CACHESIM_INTERNAL_H
+#define CACHESIM_INTERNAL_H
+
+#include "cachesim.h"
+#include <stdio.h>
+
+// most traces (cores, tenants) that one run can replay together
+#define MAX_TRACES 32
+
+typedef struct {
+	unsigned long long hits;
+	unsigned long long misses;
+	unsigned long long evictions;
+} Result;
+
+typedef struct {
+	int S;  // number of sets in the cache
+	int s;  // number of set selector bits
+	int E;  // number of cache lines per set
+	int b;  // number of block offset bits
+	int index_fn;  // how a block address picks its set, see set_of()
+	unsigned long long *index_matrix;  // s row masks for INDEX_MATRIX
+} Config;
+
+// one decoded data reference from a Valgrind trace
+typedef struct {
+	unsigned long long address;
+	char op;  // 'I', 'L', 'S' or 'M'
+	int size;
+	unsigned long long time;  // optional trailing timestamp, 0 if absent
+	int repeat;  // further accesses to the same block folded in, all hits
+	long long stride;  // with count > 1: references address + i * stride, i < count
+	int count;
+} Ref;
+
+typedef struct {
+	Ref *refs;
+	size_t n;
+} Trace;
+
+#define TRACE_BUF_RECORDS 4096
+
+// a trace file open for reading, in either format
+typedef struct {
+	FILE *file;
+	int binary;
+	char line[64];  // text: the line just read
+	csim_record_t records[TRACE_BUF_RECORDS];  // binary: buffered records
+	size_t pos;
+	size_t len;
+} TraceReader;
+
+// set index functions. INDEX_MODULO takes the low s bits of the block address
+// and is the fast path; the others keep the whole block address as the tag
+enum {
+	INDEX_MODULO = 0,
+	INDEX_MOD,     // block % S, for any S (prime-modulo indexing)
+	INDEX_XOR,     // xor of every s-bit slice of the block address
+	INDEX_MATRIX,  // bit i is the parity of the block address & row i
+};
+
+// MESI line states, used in multicore mode only
+enum {
+	MESI_I = 0,
+	MESI_S,
+	MESI_E,
+	MESI_M,
+};
+
+typedef struct {
+	int valid;
+	unsigned long long tag;
+	int state;
+	int invalidated;  // tag is stale because another core wrote the block
+	int dirty;        // stored to since it was filled; see Cache.write_back.
+	                  // with Sectors, a mask of the dirty sectors
+	unsigned int sectors;  // valid sectors, with Sectors only
+} Line;
+
+typedef struct {
+	Line *lines;
+	int E;
+	int *lru_queue;
+} Set;
+
+// open-addressing hash map from a 64-bit key to a fixed-size value. values
+// start out zeroed and the table doubles whenever it gets half full
+typedef struct {
+	unsigned long long *keys;
+	unsigned char *used;
+	char *vals;
+	size_t val_size;
+	size_t cap;
+	size_t n;
+} AddrMap;
+
+typedef struct {
+	unsigned long long start;
+	unsigned long long end;  // exclusive
+	char *name;
+} Region;
+
+// pages per chunk of counters; see Heatmap
+#define PAGE_CHUNK_BITS 12
+
+// miss attribution counters. set_misses is indexed by set, region_misses by
+// position in regions (map file mode); without a map file misses are counted
+// per 2^region_bits-byte page, indexed by page - min_page. the pages a trace
+// touches can lie terabytes apart (heap and stack), so those counters come in
+// chunks of 2^PAGE_CHUNK_BITS, allocated when a page in them first misses;
+// page_chunks grows to cover every chunk that has
+typedef struct {
+	unsigned long long *set_misses;
+	int S;
+	int region_bits;
+	Region *regions;
+	int nregions;
+	unsigned long long *region_misses;
+	unsigned long long unmapped;
+	unsigned long long min_page;  // a multiple of 2^PAGE_CHUNK_BITS
+	size_t nchunks;
+	unsigned long long **page_chunks;
+} Heatmap;
+
+typedef struct Tlb Tlb;
+typedef struct Timing Timing;
+typedef struct Victim Victim;
+typedef struct Dram Dram;
+typedef struct Sectors Sectors;
+typedef struct PageMap PageMap;
+
+typedef struct Cache {
+	Set *sets;
+	int s;
+	int S;
+	int b;
+	int index_fn;
+	unsigned long long *index_matrix;
+	int split;      // see ref_span()
+	Heatmap *heat;  // NULL unless miss attribution is enabled
+	Tlb *tlb;       // NULL unless addresses are also translated
+	unsigned int way_mask;  // ways new blocks may fill, E <= 32; 0 for all, see evict_lru()
+	struct Cache *next;     // level that misses are looked up in, or NULL
+	Result *next_result;
+	Timing *timing;         // NULL unless cycles are estimated
+	Victim *victim;         // NULL unless misses probe a victim/miss cache
+	int has_last;
+	unsigned long long last_block;  // block of the previous access, now MRU
+	int write_back;  // mark stored lines dirty and write them back on eviction
+	Dram *dram;      // NULL unless misses and writebacks reach a DRAM model
+	Sectors *sectors;  // NULL unless lines are split into sectors
+	PageMap *page_map; // NULL unless addresses are mapped to frames first
+} Cache;
+
+// sectored cache: each line of 2^b bytes holds 2^bits sectors with their own
+// valid and dirty bits. a tag miss allocates the line but fetches only the
+// touched sector; touching an absent sector of a resident line is a sector
+// miss, which fetches that sector and evicts nothing. tags and LRU order
+// evolve exactly as without sectors, so line_misses equals the misses of the
+// same cache unsectored
+struct Sectors {
+	int bits;
+	unsigned long long line_misses;
+	unsigned long long sector_misses;
+	unsigned long long fetched;      // sectors read from the next level
+	unsigned long long written_back; // dirty sectors of evicted lines
+};
+
+// small fully-associative buffer probed on every miss. as a victim cache it
+// holds the blocks evict_lru() pushes out and swaps them back on a hit; as a
+// miss cache it holds copies of recently missed blocks
+struct Victim {
+	Cache buf;
+	int miss_cache;
+	Result fills;  // misses/evictions of buf itself
+	unsigned long long probes;
+	unsigned long long hits;
+};
+
+// non-blocking cache timing: references issue issue_width per cycle, hits
+// take l1_latency, and each outstanding miss holds one of mshrs MSHRs until
+// its fill returns. issue stalls only when every MSHR is busy
+struct Timing {
+	int l1_latency;
+	int l2_latency;
+	int mem_latency;
+	int mshrs;
+	int issue_width;
+	unsigned long long *mshr_block;
+	unsigned long long *mshr_done;  // cycle the fill completes
+	unsigned long long cycle;       // issue cycle of the current reference
+	int slot;                       // references already issued this cycle
+	unsigned long long refs;
+	unsigned long long finish;      // last completion seen
+	unsigned long long latency_sum; // for AMAT
+	unsigned long long mshr_stalls; // issue cycles lost to full MSHRs
+	unsigned long long merged;      // misses to a block already in flight
+	unsigned long long miss_cycles; // sum of primary miss latencies
+	unsigned long long busy_cycles; // cycles with at least one miss outstanding
+	unsigned long long busy_until;
+};
+
+// a TLB is a cache whose blocks are pages, optionally backed by a second-level
+// TLB. a miss in the last level walks levels page-table entries
+struct Tlb {
+	Cache l1;
+	Cache l2;
+	int has_l2;
+	int levels;
+	Result l1_result;
+	Result l2_result;
+	unsigned long long walks;
+	unsigned long long walk_refs;
+};
+
+enum {
+	DRAM_OPEN,    // a bank keeps its row open for the next access
+	DRAM_CLOSED,  // and precharges after every access
+};
+
+// how a physical address picks channel, bank and row
+enum {
+	DRAM_MAP_ROW,   // a whole row, then the next channel, then the next bank
+	DRAM_MAP_LINE,  // consecutive blocks rotate over channels, then banks
+	DRAM_MAP_XOR,   // as DRAM_MAP_ROW, with the bank xor'ed with the row
+};
+
+// DRAM behind the last cache level: each block read on a miss and each dirty
+// block written back is one access to a bank of a channel, which hits when
+// the bank still has that row open
+struct Dram {
+	int channels;
+	int banks;      // per channel
+	int row_bits;   // log2 of the row (page) size in bytes
+	int block_bits;
+	int policy;
+	int map;
+	long long *open_row;  // per bank of each channel, -1 when closed
+	unsigned long long *bank_conflicts;
+	unsigned long long reads;
+	unsigned long long writes;
+	unsigned long long row_hits;
+	unsigned long long row_empty;      // bank had no row open
+	unsigned long long row_conflicts;  // bank had another row open
+};
+
+enum {
+	PAGE_IDENTITY,  // every page is its own frame
+	PAGE_RANDOM,    // a random free frame on first touch
+	PAGE_COLOR,     // a random free frame of the page's own color
+};
+
+// physical memory the page map allocates frames from
+#define PAGE_PHYS_BITS 40
+
+// virtual-to-physical page mapping applied in ref_mem() before set indexing,
+// as a physically indexed cache sees it. a page's color is the part of its
+// frame number that falls in the set index of the cache colors is computed
+// for; page coloring keeps that part of the virtual page number
+struct PageMap {
+	int policy;
+	int page_bits;
+	int colors;  // a power of two
+	unsigned long long rng;
+	AddrMap frames;  // virtual page -> frame + 1
+	AddrMap used;    // frame -> nonzero once allocated
+	unsigned long long pages;
+	unsigned long long *color_pages;  // pages mapped to frames of each color
+};
+
+// directory entry for one block: which L1s hold it, plus write history used
+// to flag false sharing
+typedef struct {
+	unsigned int sharers;
+	int last_writer;  // core+1 of the last store, 0 if never written
+	int last_offset;
+	unsigned int writers;
+	unsigned long long false_sharing;  // stores by another core at another offset
+	unsigned long long invalidations;
+} DirEntry;
+
+// private MESI-coherent L1s over a shared LLC, kept coherent through a
+// directory keyed by block address
+typedef struct {
+	int ncores;
+	Cache l1[MAX_TRACES];
+	Result l1_result[MAX_TRACES];
+	unsigned long long sharing_misses[MAX_TRACES];
+	Cache llc;
+	Result llc_result;
+	AddrMap directory;  // block -> DirEntry
+	unsigned long long invalidations;
+	unsigned long long upgrades;       // S -> M on a store hit
+	unsigned long long interventions;  // misses that downgraded an E/M copy elsewhere
+	unsigned long long writebacks;     // M lines written back to the LLC
+} Multicore;
+
+// configuration
+int log2_exact(int n);
+int is_prime(int n);
+int build_config(Config *config, int s, int E, int b);
+int configure_sets(Config *config, int sets);
+int load_index_matrix(Config *config, const char *path);
+
+// caches and the models attached to them
+int allocate_cache(Cache *cache, Config *config);
+void deallocate_cache(Cache *cache);
+int set_of(Cache *cache, unsigned long long block, unsigned long long *tag);
+int ref_span(Cache *cache, unsigned long long address, int size, int store, Result *result);
+int init_heatmap(Heatmap *heat, int S, int region_bits, const char *region_map_path);
+void free_heatmap(Heatmap *heat);
+int allocate_victim(Victim *victim, int entries, int b, int miss_cache);
+int allocate_tlb(Tlb *tlb, int entries, int ways, int stlb_entries, int stlb_ways, int page_bits);
+void deallocate_tlb(Tlb *tlb);
+int init_timing(Timing *timing, int l1_latency, int l2_latency, int mem_latency,
+                int mshrs, int issue_width);
+void free_timing(Timing *timing);
+int init_dram(Dram *dram, int channels, int banks, int row_bytes, int b, int policy, int map);
+void free_dram(Dram *dram);
+int init_page_map(PageMap *map, int policy, int page_bits, int colors, unsigned long long seed);
+void free_page_map(PageMap *map);
+
+// address-keyed hash map
+int init_addr_map(AddrMap *map, size_t val_size);
+void free_addr_map(AddrMap *map);
+void *addr_map_get(AddrMap *map, unsigned long long key, int create);
+
+// traces
+int open_trace(TraceReader *reader, const char *trace_file_path);
+int read_ref(TraceReader *reader, Ref *ref);
+const char *trace_line(TraceReader *reader, Ref *ref);
+void close_trace(TraceReader *reader);
+int load_trace(Trace *trace, const char *trace_file_path);
+void free_traces(Trace *traces, int n);
+int next_trace(Trace *traces, size_t *pos, int n, int *turn, int by_time);
+void replay_ref(Cache *cache, Ref *ref, Result *result);
+int can_coalesce(Cache *cache);
+int single_block(Cache *cache, Ref *ref, int b);
+void fold_ref(Ref *run, Ref *ref);
+void coalesce_trace(Trace *trace, Cache *cache, int b);
+void encode_strides(Trace *trace, int merge_stores);
+int stride_run(Ref *ref, int i, int b);
+int bulk_stride(Cache *cache, Ref *ref, int b);
+
+// multicore coherence
+int coherent_ref(Multicore *mc, int core, unsigned long long address, int store);
+
+#endif /* CACHESIM_INTERNAL_H */
@@ -0,0 +1,2023 @@
+/*
+ * cachesim.c - The cache models behind csim
+ *
+ * Everything here is driven by csim's command line front end, and the
+ * csim_* functions at the bottom wrap the common configuration (one level
+ * with optional victim cache and L2) for callers that simulate in-process.
+ */
+#define _XOPEN_SOURCE 700
+#include "cachesim-internal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+// the cache calls into the models attached to it, which are defined further
+// down next to the parts they model
+static int ref_mem(Cache *cache, unsigned long long address, Result *result);
+static void dram_access(Dram *dram, unsigned long long address, int write);
+static unsigned long long map_page(PageMap *map, unsigned long long address);
+static void replay_stride(Cache *cache, Ref *ref, Result *result);
+
+static int pow2(int i)
+{
+	if (i > 30)
+		return -1;
+	return 1<<i;
+}
+
+// log2 of n, or -1 if n is not a power of two
+int log2_exact(int n)
+{
+	int i = 0;
+	while (i < 31 && (1 << i) < n)
+		++i;
+	return (1 << i) == n ? i : -1;
+}
+
+int build_config(Config *config, int s, int E, int b)
+{
+	config->s = s;
+	config->E = E;
+	config->b = b;
+	config->index_fn = INDEX_MODULO;
+	config->index_matrix = NULL;
+	if ((config->S = pow2(s)) == -1)
+		return -1;
+	return 0;
+}
+
+// an explicit set count; anything but a power of two is indexed by modulo
+int configure_sets(Config *config, int sets)
+{
+	if (sets < 1)
+		return -1;
+	config->S = sets;
+	if (log2_exact(sets) == -1)
+		config->index_fn = INDEX_MOD;
+	else
+		config->s = log2_exact(sets);
+	return 0;
+}
+
+int is_prime(int n)
+{
+	if (n < 2)
+		return 0;
+	for (int d = 2; d <= n / d; ++d)
+		if (n % d == 0)
+			return 0;
+	return 1;
+}
+
+// matrix file: one hex row mask per line, row i selecting the block address
+// bits whose parity gives set index bit i
+int load_index_matrix(Config *config, const char *path)
+{
+	FILE *matrix_file;
+	if ((matrix_file = fopen(path, "r")) == NULL)
+		return -1;
+	unsigned long long rows[30];
+	int n = 0;
+	while (n < 30 && fscanf(matrix_file, "%llx", &rows[n]) == 1)
+		++n;
+	int bad = !feof(matrix_file) && fgetc(matrix_file) != '\n';
+	fclose(matrix_file);
+	if (bad || n == 0)
+		return -1;
+	if ((config->index_matrix = (unsigned long long *) malloc(n * sizeof(unsigned long long))) == NULL)
+		return -1;
+	memcpy(config->index_matrix, rows, n * sizeof(unsigned long long));
+	config->s = n;
+	config->S = 1 << n;
+	return 0;
+}
+
+static int init_lru_queue(Set *set, int E)
+{
+	if ((set->lru_queue = (int *) malloc(E * sizeof(int))) == NULL)
+		return -1;
+	for (int i = 0; i < E; ++i)
+		set->lru_queue[i] = i;
+	return 0;
+}
+
+int allocate_cache(Cache *cache, Config *config)
+{
+	cache->s = config->s;
+	cache->S = config->S;
+	cache->b = config->b;
+	cache->index_fn = config->index_fn;
+	cache->index_matrix = config->index_matrix;
+	cache->split = 0;
+	cache->heat = NULL;
+	cache->tlb = NULL;
+	cache->way_mask = 0;
+	cache->next = NULL;
+	cache->next_result = NULL;
+	cache->timing = NULL;
+	cache->victim = NULL;
+	cache->has_last = 0;
+	cache->write_back = 0;
+	cache->dram = NULL;
+	cache->sectors = NULL;
+	cache->page_map = NULL;
+	// allocate array of sets
+	if ((cache->sets = (Set *) malloc(config->S * sizeof(Set))) == NULL)
+		return -1;
+
+	for (int i = 0; i < config->S; ++i) {
+		// allocate array of lines for each set
+		if ((cache->sets[i].lines = (Line *) malloc(config->E * sizeof(Line))) == NULL)
+			return -1;
+		cache->sets[i].E = config->E;
+		// set valid bits to 0 for each line
+		for (int j = 0; j < config->E; ++j) {
+			cache->sets[i].lines[j].valid = 0;
+			cache->sets[i].lines[j].state = MESI_I;
+			cache->sets[i].lines[j].invalidated = 0;
+			cache->sets[i].lines[j].dirty = 0;
+		}
+		if ((init_lru_queue(&cache->sets[i], config->E)) == -1)
+			return -1;
+	}
+
+	return 0;
+}
+
+void deallocate_cache(Cache *cache)
+{
+	for (int i = 0; i < cache->S; ++i) {
+		free(cache->sets[i].lines);
+		free(cache->sets[i].lru_queue);
+	}
+	free(cache->sets);
+}
+
+static size_t hash_key(unsigned long long key)
+{
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdULL;
+	key ^= key >> 33;
+	return (size_t) key;
+}
+
+static int alloc_addr_map(AddrMap *map, size_t cap)
+{
+	map->cap = cap;
+	map->n = 0;
+	map->keys = (unsigned long long *) malloc(cap * sizeof(unsigned long long));
+	map->used = (unsigned char *) calloc(cap, 1);
+	map->vals = (char *) calloc(cap, map->val_size);
+	if (map->keys == NULL || map->used == NULL || map->vals == NULL)
+		return -1;
+	return 0;
+}
+
+int init_addr_map(AddrMap *map, size_t val_size)
+{
+	map->val_size = val_size;
+	return alloc_addr_map(map, 1024);
+}
+
+void free_addr_map(AddrMap *map)
+{
+	free(map->keys);
+	free(map->used);
+	free(map->vals);
+}
+
+static int grow_addr_map(AddrMap *map)
+{
+	AddrMap old = *map;
+	if (alloc_addr_map(map, old.cap * 2) == -1) {
+		free_addr_map(map);
+		*map = old;
+		return -1;
+	}
+	for (size_t i = 0; i < old.cap; ++i)
+		if (old.used[i])
+			memcpy(addr_map_get(map, old.keys[i], 1),
+			       old.vals + i * old.val_size, old.val_size);
+	free_addr_map(&old);
+	return 0;
+}
+
+// returns the value stored under key, inserting a zeroed one if create is set.
+// returns NULL if the key is absent (or the table could not grow)
+void *addr_map_get(AddrMap *map, unsigned long long key, int create)
+{
+	size_t mask = map->cap - 1;
+	size_t i = hash_key(key) & mask;
+	while (map->used[i]) {
+		if (map->keys[i] == key)
+			return map->vals + i * map->val_size;
+		i = (i + 1) & mask;
+	}
+	if (!create)
+		return NULL;
+	if ((map->n + 1) * 2 > map->cap) {
+		if (grow_addr_map(map) == -1)
+			return NULL;
+		return addr_map_get(map, key, create);
+	}
+	map->used[i] = 1;
+	map->keys[i] = key;
+	map->n++;
+	return map->vals + i * map->val_size;
+}
+
+static int compare_regions(const void *a, const void *b)
+{
+	const Region *ra = a, *rb = b;
+	return (ra->start > rb->start) - (ra->start < rb->start);
+}
+
+// region map file: one "<start> <end> <name>" line per region, addresses in
+// hex, end exclusive. blank lines and lines starting with '#' are skipped
+static int load_region_map(Heatmap *heat, const char *path)
+{
+	FILE *map_file;
+	if ((map_file = fopen(path, "r")) == NULL)
+		return -1;
+
+	int cap = 16;
+	heat->nregions = 0;
+	if ((heat->regions = (Region *) malloc(cap * sizeof(Region))) == NULL)
+		return -1;
+	char line_str[256], name[200];
+	unsigned long long start, end;
+	while (fgets(line_str, sizeof(line_str), map_file) != NULL) {
+		if (line_str[0] == '#' || line_str[0] == '\n')
+			continue;
+		if (sscanf(line_str, "%llx %llx %199s", &start, &end, name) != 3 || end <= start) {
+			fclose(map_file);
+			return -1;
+		}
+		if (heat->nregions == cap) {
+			cap *= 2;
+			Region *grown = (Region *) realloc(heat->regions, cap * sizeof(Region));
+			if (grown == NULL) {
+				fclose(map_file);
+				return -1;
+			}
+			heat->regions = grown;
+		}
+		Region *region = &heat->regions[heat->nregions++];
+		region->start = start;
+		region->end = end;
+		if ((region->name = (char *) malloc(strlen(name) + 1)) == NULL) {
+			fclose(map_file);
+			return -1;
+		}
+		strcpy(region->name, name);
+	}
+	fclose(map_file);
+	qsort(heat->regions, heat->nregions, sizeof(Region), compare_regions);
+	if ((heat->region_misses = (unsigned long long *)
+	     calloc(heat->nregions, sizeof(unsigned long long))) == NULL)
+		return -1;
+	return 0;
+}
+
+int init_heatmap(Heatmap *heat, int S, int region_bits, const char *region_map_path)
+{
+	heat->S = S;
+	heat->region_bits = region_bits;
+	heat->regions = NULL;
+	heat->nregions = 0;
+	heat->region_misses = NULL;
+	heat->unmapped = 0;
+	if ((heat->set_misses = (unsigned long long *)
+	     calloc(S, sizeof(unsigned long long))) == NULL)
+		return -1;
+	heat->min_page = 0;
+	heat->nchunks = 0;
+	heat->page_chunks = NULL;
+	if (region_map_path != NULL)
+		return load_region_map(heat, region_map_path);
+	return 0;
+}
+
+void free_heatmap(Heatmap *heat)
+{
+	free(heat->set_misses);
+	if (heat->regions != NULL) {
+		for (int i = 0; i < heat->nregions; ++i)
+			free(heat->regions[i].name);
+		free(heat->regions);
+		free(heat->region_misses);
+	} else {
+		for (size_t i = 0; i < heat->nchunks; ++i)
+			free(heat->page_chunks[i]);
+		free(heat->page_chunks);
+	}
+}
+
+// widens page_chunks to cover the chunk holding page, by at least its own
+// size so that a trace walking up or down its pages grows it only a
+// logarithmic number of times. returns -1 if out of memory
+static int cover_page(Heatmap *heat, unsigned long long page)
+{
+	unsigned long long chunk = page >> PAGE_CHUNK_BITS;
+	unsigned long long first = heat->min_page >> PAGE_CHUNK_BITS;
+	unsigned long long end = first + heat->nchunks;
+	if (heat->nchunks == 0)
+		first = end = chunk;
+	if (chunk < first)
+		first = chunk > heat->nchunks ? chunk - heat->nchunks : 0;
+	else
+		end = chunk + 1 + heat->nchunks;
+	unsigned long long **chunks;
+	if ((chunks = (unsigned long long **) calloc(end - first, sizeof(unsigned long long *))) == NULL)
+		return -1;
+	if (heat->nchunks)
+		memcpy(chunks + ((heat->min_page >> PAGE_CHUNK_BITS) - first), heat->page_chunks,
+		       heat->nchunks * sizeof(unsigned long long *));
+	free(heat->page_chunks);
+	heat->page_chunks = chunks;
+	heat->min_page = first << PAGE_CHUNK_BITS;
+	heat->nchunks = end - first;
+	return 0;
+}
+
+// index of the region containing address, or -1
+static int find_region(Heatmap *heat, unsigned long long address)
+{
+	int lo = 0, hi = heat->nregions - 1;
+	while (lo <= hi) {
+		int mid = lo + (hi - lo) / 2;
+		if (address < heat->regions[mid].start)
+			hi = mid - 1;
+		else if (address >= heat->regions[mid].end)
+			lo = mid + 1;
+		else
+			return mid;
+	}
+	return -1;
+}
+
+static void record_miss(Heatmap *heat, int index, unsigned long long address)
+{
+	heat->set_misses[index]++;
+	if (heat->regions != NULL) {
+		int r = find_region(heat, address);
+		if (r == -1)
+			heat->unmapped++;
+		else
+			heat->region_misses[r]++;
+		return;
+	}
+	unsigned long long page = address >> heat->region_bits;
+	unsigned long long i = page - heat->min_page;
+	if (i >> PAGE_CHUNK_BITS >= heat->nchunks) {
+		if (cover_page(heat, page) == -1) {
+			heat->unmapped++;
+			return;
+		}
+		i = page - heat->min_page;
+	}
+	unsigned long long **chunk = &heat->page_chunks[i >> PAGE_CHUNK_BITS];
+	if (*chunk == NULL &&
+	    (*chunk = (unsigned long long *) calloc(1 << PAGE_CHUNK_BITS,
+	                                            sizeof(unsigned long long))) == NULL) {
+		heat->unmapped++;
+		return;
+	}
+	(*chunk)[i & ((1 << PAGE_CHUNK_BITS) - 1)]++;
+}
+
+static int index_of(int *lru_queue, int line)
+{
+	int i = 0;
+	while (*lru_queue != line) {
+		lru_queue++;
+		++i;
+	}
+	return i;
+}
+
+static void update_lru_queue(int *lru_queue, int line, int len)
+{
+	int index = index_of(lru_queue, line);
+	if (index == (len-1))
+		return;
+	int tmp = lru_queue[len-1];
+	lru_queue[len-1] = lru_queue[index];
+	while (index < len-2) {
+		lru_queue[index] = lru_queue[index+1];
+		++index;
+	}
+	lru_queue[len-2] = tmp;
+}
+
+// way_mask restricts which lines may be (re)allocated, bit i standing for
+// line i, so it needs E <= 32; 0 allows every line. returns the tag that was
+// evicted
+static unsigned long long evict_lru(Set *set, unsigned long long tag, unsigned int way_mask, int *dirty)
+{
+	int k = 0;
+	if (way_mask)
+		while (!(way_mask & (1u << set->lru_queue[k])))
+			++k;
+	int line_index = set->lru_queue[k];
+	unsigned long long evicted = set->lines[line_index].tag;
+	*dirty = set->lines[line_index].dirty;
+	set->lines[line_index].tag = tag;
+	set->lines[line_index].dirty = 0;
+	update_lru_queue(set->lru_queue, line_index, set->E);
+	return evicted;
+}
+
+// fills tag into set; returns 1 and stores the evicted tag and its dirty bits
+// if a valid line had to make room
+static int update(Set *set, unsigned long long tag, unsigned int way_mask, unsigned long long *evicted,
+           int *dirty)
+{
+	int added = 0;
+	for (int i = 0; i < set->E; ++i) {
+		if (set->lines[i].valid == 0 && (!way_mask || (way_mask & (1u << i)))) {
+			set->lines[i].valid = 1;
+			set->lines[i].tag = tag;
+			set->lines[i].dirty = 0;
+			added = 1;
+			update_lru_queue(set->lru_queue, i, set->E);
+			break;
+		}
+	}
+	if (!added) {
+		*evicted = evict_lru(set, tag, way_mask, dirty);
+		return 1;
+	}
+	return 0;
+}
+
+static int hashed_index(Cache *cache, unsigned long long block)
+{
+	unsigned long long index = 0;
+	switch (cache->index_fn) {
+	case INDEX_MOD:
+		return block % cache->S;
+	case INDEX_XOR:
+		if (cache->s == 0)
+			return 0;
+		for (; block; block >>= cache->s)
+			index ^= block;
+		return index & (cache->S - 1);
+	default:
+		for (int i = 0; i < cache->s; ++i)
+			index |= (unsigned long long) __builtin_parityll(block & cache->index_matrix[i]) << i;
+		return index;
+	}
+}
+
+// returns the set that block maps to and stores the tag kept for it
+int set_of(Cache *cache, unsigned long long block, unsigned long long *tag)
+{
+	if (cache->index_fn == INDEX_MODULO) {
+		*tag = block >> cache->s;
+		return block & (cache->S - 1);
+	}
+	*tag = block;
+	return hashed_index(cache, block);
+}
+
+// inverse of set_of()
+static unsigned long long block_of(Cache *cache, unsigned long long tag, int index)
+{
+	if (cache->index_fn == INDEX_MODULO)
+		return (tag << cache->s) | index;
+	return tag;
+}
+
+int allocate_victim(Victim *victim, int entries, int b, int miss_cache)
+{
+	Config config;
+	memset(victim, 0, sizeof(Victim));
+	victim->miss_cache = miss_cache;
+	if (build_config(&config, 0, entries, b) == -1)
+		return -1;
+	return allocate_cache(&victim->buf, &config);
+}
+
+// looks block up on a miss. a victim cache hands the block back to the cache
+// and drops its copy; a miss cache keeps it
+static int probe_victim(Victim *victim, unsigned long long block)
+{
+	Set *set = &victim->buf.sets[0];
+	victim->probes++;
+	victim->buf.has_last = 0;
+	for (int i = 0; i < set->E; ++i)
+		if (set->lines[i].valid && set->lines[i].tag == block) {
+			victim->hits++;
+			if (victim->miss_cache)
+				update_lru_queue(set->lru_queue, i, set->E);
+			else
+				set->lines[i].valid = 0;
+			return 1;
+		}
+	return 0;
+}
+
+static void fill_victim(Victim *victim, unsigned long long block)
+{
+	ref_mem(&victim->buf, block << victim->buf.b, &victim->fills);
+}
+
+// the bit of the sector holding address within its line
+static unsigned int sector_bit(Cache *cache, unsigned long long address)
+{
+	int bits = cache->sectors->bits;
+	return 1u << ((address >> (cache->b - bits)) & ((1u << bits) - 1));
+}
+
+static int count_bits(unsigned int mask)
+{
+	int n = 0;
+	for (; mask; mask &= mask - 1)
+		++n;
+	return n;
+}
+
+// marks the block (or sector) holding address dirty. it was just accessed,
+// so it is the MRU line of its set
+static void mark_dirty(Cache *cache, unsigned long long address)
+{
+	unsigned long long tag;
+	if (cache->page_map)
+		address = map_page(cache->page_map, address);
+	Set *set = &cache->sets[set_of(cache, address >> cache->b, &tag)];
+	Line *line = &set->lines[set->lru_queue[set->E - 1]];
+	if (line->valid && line->tag == tag)
+		line->dirty |= cache->sectors ? sector_bit(cache, address) : 1;
+}
+
+// a dirty block evicted from cache goes to the next level, which only marks
+// its copy dirty (writebacks never allocate), or past it when it has none
+static void write_back(Cache *cache, unsigned long long block)
+{
+	unsigned long long address = block << cache->b;
+	for (Cache *level = cache->next; level != NULL; cache = level, level = level->next) {
+		unsigned long long tag;
+		Set *set = &level->sets[set_of(level, address >> level->b, &tag)];
+		for (int i = 0; i < set->E; ++i)
+			if (set->lines[i].valid && set->lines[i].tag == tag) {
+				set->lines[i].dirty = 1;
+				return;
+			}
+	}
+	if (cache->dram)
+		dram_access(cache->dram, address, 1);
+}
+
+// a resident line of a sectored cache lacks the sector holding address: it
+// counts as a miss and fetches just that sector, evicting nothing
+static int ref_sector(Cache *cache, Line *line, unsigned long long address, Result *result)
+{
+	result->misses++;
+	cache->sectors->sector_misses++;
+	cache->sectors->fetched++;
+	line->sectors |= sector_bit(cache, address);
+	int outcome = REF_MISS;
+	if (cache->next) {
+		if (ref_mem(cache->next, address, cache->next_result) & REF_MISS)
+			outcome |= REF_NEXT_MISS;
+	} else if (cache->dram)
+		dram_access(cache->dram, address, 0);
+	return outcome;
+}
+
+static int ref_mem(Cache *cache, unsigned long long address, Result *result)
+{
+	// levels below see the physical address; misses are attributed to the
+	// virtual one
+	unsigned long long virtual_address = address;
+	if (cache->page_map)
+		address = map_page(cache->page_map, address);
+	unsigned long long full_address = address;
+	// don't need the b bits
+	address >>= cache->b;
+	// same block as last time: it is still resident and already MRU. not so
+	// with sectors, as another sector of the block may be absent
+	if (cache->has_last && address == cache->last_block) {
+		result->hits++;
+		return REF_HIT;
+	}
+	cache->has_last = cache->sectors == NULL;
+	cache->last_block = address;
+	int index;
+	unsigned long long tag;
+	if (cache->index_fn == INDEX_MODULO) {
+		index = address & (pow2(cache->s)-1);
+		tag = address >> cache->s;
+	} else {
+		index = hashed_index(cache, address);
+		tag = address;
+	}
+	for (int i = 0; i < cache->sets[index].E; ++i) {
+		if (cache->sets[index].lines[i].valid &&
+                    cache->sets[index].lines[i].tag == tag) {
+			update_lru_queue(cache->sets[index].lru_queue, i, cache->sets[index].E);
+			if (cache->sectors && !(cache->sets[index].lines[i].sectors & sector_bit(cache, full_address))) {
+				if (cache->heat)
+					record_miss(cache->heat, index, virtual_address);
+				return ref_sector(cache, &cache->sets[index].lines[i], full_address, result);
+			}
+			result->hits++;
+			return REF_HIT;
+		}
+	}
+	result->misses++;
+	if (cache->sectors) {
+		cache->sectors->line_misses++;
+		cache->sectors->fetched++;
+	}
+	if (cache->heat)
+		record_miss(cache->heat, index, virtual_address);
+	int outcome = REF_MISS;
+	if (cache->victim && probe_victim(cache->victim, address))
+		outcome |= REF_VICTIM_HIT;
+	else if (cache->next) {
+		if (ref_mem(cache->next, full_address, cache->next_result) & REF_MISS)
+			outcome |= REF_NEXT_MISS;
+	} else if (cache->dram)
+		dram_access(cache->dram, full_address, 0);
+	unsigned long long evicted;
+	int dirty = 0;
+	if (update(&cache->sets[index], tag, cache->way_mask, &evicted, &dirty)) {
+		result->evictions++;
+		outcome |= REF_EVICTION;
+		if (cache->victim && !cache->victim->miss_cache)
+			fill_victim(cache->victim, block_of(cache, evicted, index));
+		if (dirty)
+			write_back(cache, block_of(cache, evicted, index));
+		if (cache->sectors)
+			cache->sectors->written_back += count_bits(dirty);
+	}
+	if (cache->sectors) {
+		Set *set = &cache->sets[index];
+		set->lines[set->lru_queue[set->E - 1]].sectors = sector_bit(cache, full_address);
+	}
+	if (cache->victim && cache->victim->miss_cache && !(outcome & REF_VICTIM_HIT))
+		fill_victim(cache->victim, address);
+	return outcome;
+}
+
+static int build_tlb_config(Config *config, int entries, int ways, int page_bits)
+{
+	int s;
+	if ((s = log2_exact(entries / ways)) == -1)
+		return -1;
+	return build_config(config, s, ways, page_bits);
+}
+
+int allocate_tlb(Tlb *tlb, int entries, int ways, int stlb_entries, int stlb_ways, int page_bits)
+{
+	Config config;
+	memset(tlb, 0, sizeof(Tlb));
+	// x86-64 walks 4 levels for a 4 KB page, one fewer per larger page size
+	tlb->levels = 4 - (page_bits - 12) / 9;
+	if (build_tlb_config(&config, entries, ways, page_bits) == -1)
+		return -1;
+	if (allocate_cache(&tlb->l1, &config) == -1)
+		return -1;
+	if (stlb_entries) {
+		if (build_tlb_config(&config, stlb_entries, stlb_ways, page_bits) == -1)
+			return -1;
+		if (allocate_cache(&tlb->l2, &config) == -1)
+			return -1;
+		tlb->has_l2 = 1;
+	}
+	return 0;
+}
+
+void deallocate_tlb(Tlb *tlb)
+{
+	deallocate_cache(&tlb->l1);
+	if (tlb->has_l2)
+		deallocate_cache(&tlb->l2);
+}
+
+static void translate(Tlb *tlb, unsigned long long address)
+{
+	if (!(ref_mem(&tlb->l1, address, &tlb->l1_result) & REF_MISS))
+		return;
+	if (tlb->has_l2 && !(ref_mem(&tlb->l2, address, &tlb->l2_result) & REF_MISS))
+		return;
+	tlb->walks++;
+	tlb->walk_refs += tlb->levels;
+}
+
+int init_timing(Timing *timing, int l1_latency, int l2_latency, int mem_latency,
+                int mshrs, int issue_width)
+{
+	memset(timing, 0, sizeof(Timing));
+	timing->l1_latency = l1_latency;
+	timing->l2_latency = l2_latency;
+	timing->mem_latency = mem_latency;
+	timing->mshrs = mshrs;
+	timing->issue_width = issue_width;
+	timing->mshr_block = (unsigned long long *) calloc(mshrs, sizeof(unsigned long long));
+	timing->mshr_done = (unsigned long long *) calloc(mshrs, sizeof(unsigned long long));
+	if (timing->mshr_block == NULL || timing->mshr_done == NULL)
+		return -1;
+	return 0;
+}
+
+void free_timing(Timing *timing)
+{
+	free(timing->mshr_block);
+	free(timing->mshr_done);
+}
+
+int init_dram(Dram *dram, int channels, int banks, int row_bytes, int b, int policy, int map)
+{
+	memset(dram, 0, sizeof(Dram));
+	if (log2_exact(channels) == -1 || log2_exact(banks) == -1 ||
+	    (dram->row_bits = log2_exact(row_bytes)) < b)
+		return -1;
+	dram->channels = channels;
+	dram->banks = banks;
+	dram->block_bits = b;
+	dram->policy = policy;
+	dram->map = map;
+	dram->open_row = (long long *) malloc(channels * banks * sizeof(long long));
+	dram->bank_conflicts = (unsigned long long *) calloc(channels * banks, sizeof(unsigned long long));
+	if (dram->open_row == NULL || dram->bank_conflicts == NULL)
+		return -1;
+	for (int i = 0; i < channels * banks; ++i)
+		dram->open_row[i] = -1;
+	return 0;
+}
+
+void free_dram(Dram *dram)
+{
+	free(dram->open_row);
+	free(dram->bank_conflicts);
+}
+
+static void dram_access(Dram *dram, unsigned long long address, int write)
+{
+	int channel_bits = log2_exact(dram->channels);
+	int bank_bits = log2_exact(dram->banks);
+	unsigned long long row = address >> (dram->row_bits + channel_bits + bank_bits);
+	unsigned long long channel, bank;
+	if (dram->map == DRAM_MAP_LINE) {
+		channel = (address >> dram->block_bits) & (dram->channels - 1);
+		bank = (address >> (dram->block_bits + channel_bits)) & (dram->banks - 1);
+	} else {
+		channel = (address >> dram->row_bits) & (dram->channels - 1);
+		bank = (address >> (dram->row_bits + channel_bits)) & (dram->banks - 1);
+		if (dram->map == DRAM_MAP_XOR)
+			bank ^= row & (dram->banks - 1);
+	}
+	if (write)
+		dram->writes++;
+	else
+		dram->reads++;
+	int i = (int) (channel * dram->banks + bank);
+	if (dram->open_row[i] == (long long) row)
+		dram->row_hits++;
+	else if (dram->open_row[i] == -1)
+		dram->row_empty++;
+	else {
+		dram->row_conflicts++;
+		dram->bank_conflicts[i]++;
+	}
+	dram->open_row[i] = dram->policy == DRAM_OPEN ? (long long) row : -1;
+}
+
+// splitmix64
+static unsigned long long next_frame_rand(unsigned long long *state)
+{
+	unsigned long long z = (*state += 0x9e3779b97f4a7c15ULL);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+int init_page_map(PageMap *map, int policy, int page_bits, int colors, unsigned long long seed)
+{
+	memset(map, 0, sizeof(PageMap));
+	if (log2_exact(colors) == -1 || page_bits >= PAGE_PHYS_BITS ||
+	    (unsigned long long) colors > 1ULL << (PAGE_PHYS_BITS - page_bits))
+		return -1;
+	map->policy = policy;
+	map->page_bits = page_bits;
+	map->colors = colors;
+	map->rng = seed;
+	if ((map->color_pages = (unsigned long long *) calloc(colors, sizeof(unsigned long long))) == NULL ||
+	    init_addr_map(&map->frames, sizeof(unsigned long long)) == -1 ||
+	    init_addr_map(&map->used, 1) == -1)
+		return -1;
+	return 0;
+}
+
+void free_page_map(PageMap *map)
+{
+	free(map->color_pages);
+	free_addr_map(&map->frames);
+	free_addr_map(&map->used);
+}
+
+// picks the frame for a page touched for the first time. returns the page
+// itself if the frame table cannot grow
+static unsigned long long alloc_frame(PageMap *map, unsigned long long page)
+{
+	unsigned long long frame_mask = (1ULL << (PAGE_PHYS_BITS - map->page_bits)) - 1;
+	unsigned long long color_mask = map->colors - 1;
+	unsigned long long frame = page;
+	while (map->policy != PAGE_IDENTITY) {
+		frame = next_frame_rand(&map->rng) & frame_mask;
+		if (map->policy == PAGE_COLOR)
+			frame = (frame & ~color_mask) | (page & color_mask);
+		char *used = addr_map_get(&map->used, frame, 1);
+		if (used == NULL)
+			return page;
+		if (!*used) {
+			*used = 1;
+			break;
+		}
+	}
+	map->pages++;
+	map->color_pages[frame & color_mask]++;
+	return frame;
+}
+
+static unsigned long long map_page(PageMap *map, unsigned long long address)
+{
+	unsigned long long *frame = addr_map_get(&map->frames, address >> map->page_bits, 1);
+	if (frame == NULL)
+		return address;
+	if (*frame == 0)
+		*frame = alloc_frame(map, address >> map->page_bits) + 1;
+	return ((*frame - 1) << map->page_bits) | (address & ((1ULL << map->page_bits) - 1));
+}
+
+// the MSHR whose fill of block is still outstanding at the current cycle, or -1
+static int find_mshr(Timing *timing, unsigned long long block)
+{
+	for (int i = 0; i < timing->mshrs; ++i)
+		if (timing->mshr_done[i] > timing->cycle && timing->mshr_block[i] == block)
+			return i;
+	return -1;
+}
+
+// advances the clock by one issued reference and accounts for its latency
+static void time_ref(Timing *timing, unsigned long long block, int outcome, int has_l2)
+{
+	if (timing->slot == timing->issue_width) {
+		timing->cycle++;
+		timing->slot = 0;
+	}
+	timing->slot++;
+	timing->refs++;
+
+	unsigned long long latency = timing->l1_latency;
+	int i = find_mshr(timing, block);
+	if (i != -1) {
+		// the block was allocated by a miss whose fill has not returned yet
+		latency = timing->mshr_done[i] - timing->cycle;
+		if (outcome & REF_MISS)
+			timing->merged++;
+	} else if ((outcome & REF_MISS) && !(outcome & REF_VICTIM_HIT)) {
+		if (has_l2)
+			latency += timing->l2_latency;
+		if (!has_l2 || (outcome & REF_NEXT_MISS))
+			latency += timing->mem_latency;
+		// take a free MSHR, stalling issue until the earliest one frees up
+		int free_mshr = 0;
+		for (i = 1; i < timing->mshrs; ++i)
+			if (timing->mshr_done[i] < timing->mshr_done[free_mshr])
+				free_mshr = i;
+		if (timing->mshr_done[free_mshr] > timing->cycle) {
+			timing->mshr_stalls += timing->mshr_done[free_mshr] - timing->cycle;
+			timing->cycle = timing->mshr_done[free_mshr];
+			timing->slot = 1;
+		}
+		unsigned long long done = timing->cycle + latency;
+		timing->mshr_block[free_mshr] = block;
+		timing->mshr_done[free_mshr] = done;
+		timing->miss_cycles += latency;
+		if (timing->cycle >= timing->busy_until)
+			timing->busy_cycles += latency;
+		else if (done > timing->busy_until)
+			timing->busy_cycles += done - timing->busy_until;
+		if (done > timing->busy_until)
+			timing->busy_until = done;
+	}
+	timing->latency_sum += latency;
+	if (timing->cycle + latency > timing->finish)
+		timing->finish = timing->cycle + latency;
+}
+
+// with cache->split set, a reference of size bytes touches every block it
+// overlaps instead of just the block holding its first byte. the outcomes of
+// the touched blocks are or'ed together. a store dirties every touched block
+// of a write-back cache
+int ref_span(Cache *cache, unsigned long long address, int size, int store, Result *result)
+{
+	if (cache->tlb)
+		translate(cache->tlb, address);
+	int outcome = ref_mem(cache, address, result);
+	if (store && cache->write_back)
+		mark_dirty(cache, address);
+	unsigned long long last = address + size - 1;
+	// fast path: almost every reference fits in a single block
+	if (!cache->split || size <= 1 || ((address ^ last) >> cache->b) == 0) {
+		if (cache->timing)
+			time_ref(cache->timing, address >> cache->b, outcome, cache->next != NULL);
+		return outcome;
+	}
+	for (unsigned long long block = (address >> cache->b) + 1; block <= last >> cache->b; ++block) {
+		outcome |= ref_mem(cache, block << cache->b, result);
+		if (store && cache->write_back)
+			mark_dirty(cache, block << cache->b);
+	}
+	if (cache->timing)
+		time_ref(cache->timing, address >> cache->b, outcome, cache->next != NULL);
+	return outcome;
+}
+
+// parsing the Valgrind memory trace (csapp.cs.cmu.edu/3e/cachelab.pdf page 2)
+// returns 0 for a reference, 1 for a line to skip, -1 if malformed
+static int parse_ref(const char *line_str, Ref *ref)
+{
+	char op;
+	if (line_str[0] == 'I')
+		op = 'I';
+	else if (line_str[0] == ' ')
+		op = line_str[1];
+	else
+		return 1;
+	if (op != 'I' && op != 'L' && op != 'S' && op != 'M')
+		return -1;
+	char *end;
+	ref->op = op;
+	ref->address = strtoull(&line_str[3], &end, 16);
+	if (end == &line_str[3])
+		return -1;
+	ref->size = 0;
+	ref->time = 0;
+	ref->repeat = 0;
+	ref->stride = 0;
+	ref->count = 1;
+	if (*end == ',') {
+		ref->size = (int) strtol(end + 1, &end, 10);
+		ref->time = strtoull(end, NULL, 10);
+	}
+	return 0;
+}
+
+// returns -1 if the file cannot be opened
+int open_trace(TraceReader *reader, const char *trace_file_path)
+{
+	char magic[sizeof(CSIM_TRACE_MAGIC) - 1];
+	if ((reader->file = fopen(trace_file_path, "rb")) == NULL)
+		return -1;
+	reader->pos = reader->len = 0;
+	reader->binary = fread(magic, 1, sizeof(magic), reader->file) == sizeof(magic) &&
+	                 memcmp(magic, CSIM_TRACE_MAGIC, sizeof(magic)) == 0;
+	if (!reader->binary)
+		rewind(reader->file);
+	return 0;
+}
+
+// reads the next reference, skipping lines that are not one; returns 0 at
+// the end of the trace
+int read_ref(TraceReader *reader, Ref *ref)
+{
+	if (!reader->binary) {
+		while (fgets(reader->line, sizeof(reader->line), reader->file) != NULL)
+			if (parse_ref(reader->line, ref) == 0)
+				return 1;
+		return 0;
+	}
+	if (reader->pos == reader->len) {
+		reader->len = fread(reader->records, sizeof(csim_record_t), TRACE_BUF_RECORDS,
+		                    reader->file);
+		reader->pos = 0;
+		if (reader->len == 0)
+			return 0;
+	}
+	csim_record_t *record = &reader->records[reader->pos++];
+	ref->address = record->address;
+	ref->op = record->op;
+	ref->size = (int) record->size;
+	ref->time = 0;
+	ref->repeat = 0;
+	ref->stride = 0;
+	ref->count = 1;
+	return 1;
+}
+
+// the reference just read as a trace line without its newline, for -v
+const char *trace_line(TraceReader *reader, Ref *ref)
+{
+	if (reader->binary)
+		snprintf(reader->line, sizeof(reader->line), ref->op == 'I' ? "%c %llx,%d" : " %c %llx,%d",
+		         ref->op, ref->address, ref->size);
+	else
+		reader->line[strcspn(reader->line, "\n")] = '\0';
+	return reader->line;
+}
+
+void close_trace(TraceReader *reader)
+{
+	fclose(reader->file);
+}
+
+void replay_ref(Cache *cache, Ref *ref, Result *result)
+{
+	if (ref->op == 'I')
+		return;
+	if (ref->count > 1) {
+		replay_stride(cache, ref, result);
+		return;
+	}
+	ref_span(cache, ref->address, ref->size, ref->op == 'S', result);
+	if (ref->op == 'M')
+		ref_span(cache, ref->address, ref->size, 1, result);
+	result->hits += ref->repeat;
+	if (cache->tlb)
+		cache->tlb->l1_result.hits += ref->repeat;
+}
+
+// whether repeated accesses to one block can be folded into a single Ref:
+// nothing may need to see them one by one (nor may the caller, e.g. to print
+// each outcome)
+int can_coalesce(Cache *cache)
+{
+	return !cache->timing && !cache->sectors && (!cache->tlb || cache->tlb->l1.b >= cache->b);
+}
+
+// whether ref touches a single block of 2^b bytes
+int single_block(Cache *cache, Ref *ref, int b)
+{
+	return !cache->split || ref->size <= 1 ||
+	       ((ref->address ^ (ref->address + ref->size - 1)) >> b) == 0;
+}
+
+// folds ref, a later access to the block of run, into run. the accesses are
+// all hits, but a store among them still has to leave the block dirty
+void fold_ref(Ref *run, Ref *ref)
+{
+	run->repeat += ref->op == 'M' ? 2 : 1;
+	if (ref->op != 'L' && run->op == 'L')
+		run->op = 'S';
+}
+
+// folds every data reference into the run before it when both touch the same
+// 2^b-byte block, and drops instruction fetches
+void coalesce_trace(Trace *trace, Cache *cache, int b)
+{
+	size_t n = 0;
+	for (size_t i = 0; i < trace->n; ++i) {
+		Ref *ref = &trace->refs[i];
+		if (ref->op == 'I')
+			continue;
+		Ref *run = n ? &trace->refs[n-1] : NULL;
+		if (run != NULL && run->count == 1 && ref->count == 1 &&
+		    (run->address >> b) == (ref->address >> b) &&
+		    single_block(cache, run, b) && single_block(cache, ref, b)) {
+			fold_ref(run, ref);
+			continue;
+		}
+		trace->refs[n] = *ref;
+		trace->refs[n++].repeat = 0;
+	}
+	trace->n = n;
+}
+
+// shortest constant-stride run worth encoding as a descriptor
+#define MIN_STRIDE_RUN 8
+
+// whether loads and stores of ref's op are interchangeable: a cache that
+// writes nothing back does not tell them apart
+static int same_op(char a, char b, int merge_stores)
+{
+	return a == b || (merge_stores && a != 'M' && b != 'M');
+}
+
+// pre-pass that folds runs of at least MIN_STRIDE_RUN data references with
+// the same op and size at a constant stride into one descriptor Ref each;
+// with merge_stores a run may mix loads and stores, and then counts as
+// stores. instruction fetches are dropped
+void encode_strides(Trace *trace, int merge_stores)
+{
+	Ref *refs = trace->refs;
+	size_t n = 0;
+	for (size_t i = 0; i < trace->n; ++i)
+		if (refs[i].op != 'I')
+			refs[n++] = refs[i];
+	trace->n = n;
+
+	n = 0;
+	size_t i = 0;
+	while (i < trace->n) {
+		Ref head = refs[i];
+		size_t end = i + 1;
+		long long stride = 0;
+		if (end < trace->n)
+			stride = (long long) (refs[end].address - head.address);
+		while (end < trace->n && end - i < INT_MAX &&
+		       same_op(refs[end].op, head.op, merge_stores) && refs[end].size == head.size &&
+		       (long long) (refs[end].address - refs[end-1].address) == stride) {
+			if (refs[end].op != head.op)
+				head.op = 'S';
+			++end;
+		}
+		if (end - i >= MIN_STRIDE_RUN) {
+			head.stride = stride;
+			head.count = (int) (end - i);
+			i = end;
+		} else {
+			head = refs[i];
+			++i;
+		}
+		refs[n++] = head;
+	}
+	trace->n = n;
+}
+
+// number of references of descriptor ref, starting at reference i, that stay
+// inside the 2^b-byte block reference i falls in
+int stride_run(Ref *ref, int i, int b)
+{
+	unsigned long long address = ref->address + (unsigned long long) i * ref->stride;
+	unsigned long long block = address >> b;
+	long long len;
+	if (ref->stride == 0)
+		return ref->count - i;
+	if (ref->stride > 0)
+		len = (((block + 1) << b) - address + ref->stride - 1) / ref->stride;
+	else
+		len = (address - (block << b)) / -ref->stride + 1;
+	return len < ref->count - i ? (int) len : ref->count - i;
+}
+
+// whether a descriptor can be replayed a block at a time: every reference
+// but the first to each block is then a hit on the MRU block, as in
+// replay_ref(). larger strides fall back to one reference at a time
+int bulk_stride(Cache *cache, Ref *ref, int b)
+{
+	return !cache->split && can_coalesce(cache) &&
+	       (ref->stride < 0 ? -ref->stride : ref->stride) < (1LL << b);
+}
+
+static int find_line(Set *set, unsigned long long tag);
+
+// whether hits and misses of a run of blocks can be worked out per set by
+// replay_blocks(): a single plain LRU cache with power-of-two indexing, where
+// nothing needs to see the references one at a time
+static int plain_cache(Cache *cache)
+{
+	return cache->index_fn == INDEX_MODULO && !cache->split && !cache->heat && !cache->tlb &&
+	       !cache->way_mask && !cache->next && !cache->timing && !cache->victim &&
+	       !cache->write_back && !cache->dram && !cache->sectors && !cache->page_map;
+}
+
+static long long gcd(long long a, long long b)
+{
+	while (b) {
+		long long t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+// applies misses on blocks first + i * step, for i in [i0, i1), to set. none
+// of them is in the set. the first ones fill invalid lines, the rest evict
+// the LRU line, and once there are E of them the set holds exactly the last
+// E blocks, so only those are written into the lines
+static void miss_run(Cache *cache, Set *set, unsigned long long first, long long step,
+              unsigned long long i0, unsigned long long i1, Result *result)
+{
+	unsigned long long evicted, r = i1 - i0;
+	int dirty;
+	result->misses += r;
+	if (r < (unsigned long long) set->E) {
+		for (unsigned long long i = i0; i < i1; ++i)
+			result->evictions += update(set, (first + i * step) >> cache->s, 0, &evicted, &dirty);
+		return;
+	}
+	int invalid = 0;
+	for (int k = 0; k < set->E; ++k)
+		invalid += !set->lines[k].valid;
+	result->evictions += r - invalid;
+	for (int k = 0; k < set->E; ++k) {
+		Line *line = &set->lines[set->lru_queue[k]];
+		line->valid = 1;
+		line->tag = (first + (i1 - set->E + k) * step) >> cache->s;
+		line->dirty = 0;
+	}
+}
+
+// replays one access to each of the blocks first + k * d, k < count (d != 0),
+// on a plain_cache(). the blocks a set receives are k = j, j + P, j + 2P,
+// ... where P is the number of sets the run cycles through. they are all
+// distinct, so only those already resident can hit; the runs of misses
+// between them go through miss_run(). returns -1 (having done nothing) if
+// the run is too far-flung to index this way
+static int replay_blocks(Cache *cache, unsigned long long first, long long d, unsigned long long count,
+                  Result *result)
+{
+	long long P = cache->S / gcd(((d % cache->S) + cache->S) % cache->S, cache->S);
+	if ((d < 0 ? -d : d) > LLONG_MAX / P)
+		return -1;
+	long long step = P * d;
+	for (long long j = 0; j < P && (unsigned long long) j < count; ++j) {
+		unsigned long long start = first + j * d;
+		unsigned long long m = (count - 1 - j) / P + 1;
+		Set *set = &cache->sets[start & (cache->S - 1)];
+		// the resident blocks of the run, in the order the run reaches them
+		unsigned long long hits[set->E];
+		int nhits = 0;
+		for (int k = 0; k < set->E; ++k) {
+			if (!set->lines[k].valid)
+				continue;
+			unsigned long long block = (set->lines[k].tag << cache->s) | (start & (cache->S - 1));
+			long long diff = (long long) (block - start);
+			if (diff % step != 0 || diff / step < 0 || (unsigned long long) (diff / step) >= m)
+				continue;
+			int at = nhits++;
+			for (; at > 0 && hits[at - 1] > (unsigned long long) (diff / step); --at)
+				hits[at] = hits[at - 1];
+			hits[at] = diff / step;
+		}
+		unsigned long long i = 0;
+		for (int h = 0; h < nhits; ++h) {
+			miss_run(cache, set, start, step, i, hits[h], result);
+			unsigned long long evicted, tag = (start + hits[h] * step) >> cache->s;
+			int dirty, line = find_line(set, tag);
+			if (line != -1) {
+				update_lru_queue(set->lru_queue, line, set->E);
+				result->hits++;
+			} else {
+				result->misses++;
+				result->evictions += update(set, tag, 0, &evicted, &dirty);
+			}
+			i = hits[h] + 1;
+		}
+		miss_run(cache, set, start, step, i, m, result);
+	}
+	// the run's last block is now MRU in its set
+	cache->has_last = 1;
+	cache->last_block = first + (count - 1) * d;
+	return 0;
+}
+
+// replays a descriptor. on a plain_cache() a stride of at most a block, or of
+// whole blocks, reaches a run of distinct blocks each one block apart, or a
+// fixed number of blocks apart, which replay_blocks() handles per set. other
+// strides go a block at a time, or one reference at a time
+static void replay_stride(Cache *cache, Ref *ref, Result *result)
+{
+	long long block_bytes = 1LL << cache->b;
+	if (plain_cache(cache) && ref->stride % block_bytes == 0 && ref->stride != 0) {
+		unsigned long long first = ref->address >> cache->b;
+		if (replay_blocks(cache, first, ref->stride / block_bytes, ref->count, result) == 0) {
+			// the store half of a modify hits the block its load just brought in
+			if (ref->op == 'M')
+				result->hits += ref->count;
+			return;
+		}
+	}
+	if (plain_cache(cache) && (ref->stride < 0 ? -ref->stride : ref->stride) < block_bytes) {
+		unsigned long long first = ref->address >> cache->b;
+		unsigned long long last = (ref->address + (ref->count - 1) * ref->stride) >> cache->b;
+		unsigned long long blocks = (first > last ? first - last : last - first) + 1;
+		if (replay_blocks(cache, first, first > last ? -1 : 1, blocks, result) == 0) {
+			// every reference after the first to a block hits it
+			result->hits += ref->count - blocks + (ref->op == 'M' ? ref->count : 0);
+			return;
+		}
+	}
+	Ref one = *ref;
+	one.count = 1;
+	int bulk = bulk_stride(cache, ref, cache->b);
+	for (int i = 0; i < ref->count; ) {
+		one.address = ref->address + (unsigned long long) i * ref->stride;
+		int len = bulk ? stride_run(ref, i, cache->b) : 1;
+		one.repeat = (len - 1) * (ref->op == 'M' ? 2 : 1);
+		replay_ref(cache, &one, result);
+		i += len;
+	}
+}
+
+// decodes the whole trace up front so that several cache models can replay it
+int load_trace(Trace *trace, const char *trace_file_path)
+{
+	TraceReader reader;
+	if (open_trace(&reader, trace_file_path) == -1)
+		return -1;
+
+	size_t cap = 4096;
+	trace->n = 0;
+	if ((trace->refs = (Ref *) malloc(cap * sizeof(Ref))) == NULL) {
+		close_trace(&reader);
+		return -1;
+	}
+	for (;;) {
+		if (trace->n == cap) {
+			cap *= 2;
+			Ref *grown = (Ref *) realloc(trace->refs, cap * sizeof(Ref));
+			if (grown == NULL) {
+				close_trace(&reader);
+				return -1;
+			}
+			trace->refs = grown;
+		}
+		if (!read_ref(&reader, &trace->refs[trace->n]))
+			break;
+		trace->n++;
+	}
+	close_trace(&reader);
+	return 0;
+}
+
+static int find_line(Set *set, unsigned long long tag)
+{
+	for (int i = 0; i < set->E; ++i)
+		if (set->lines[i].valid && set->lines[i].tag == tag)
+			return i;
+	return -1;
+}
+
+// the line holding block in cache, or NULL
+static Line *lookup_line(Cache *cache, unsigned long long block)
+{
+	unsigned long long tag;
+	Set *set = &cache->sets[set_of(cache, block, &tag)];
+	int i = find_line(set, tag);
+	return i == -1 ? NULL : &set->lines[i];
+}
+
+// a miss on a tag that is still present but was invalidated by another core's
+// write is a coherence (sharing) miss rather than a capacity or conflict one
+static int was_invalidated(Set *set, unsigned long long tag)
+{
+	for (int i = 0; i < set->E; ++i)
+		if (!set->lines[i].valid && set->lines[i].invalidated && set->lines[i].tag == tag)
+			return 1;
+	return 0;
+}
+
+static void invalidate_others(Multicore *mc, int core, unsigned long long block, DirEntry *dir)
+{
+	for (int c = 0; c < mc->ncores; ++c) {
+		if (c == core || !(dir->sharers & (1u << c)))
+			continue;
+		Line *line = lookup_line(&mc->l1[c], block);
+		if (line == NULL)
+			continue;
+		if (line->state == MESI_M)
+			mc->writebacks++;
+		line->valid = 0;
+		line->state = MESI_I;
+		line->invalidated = 1;
+		mc->invalidations++;
+		dir->invalidations++;
+	}
+	dir->sharers &= 1u << core;
+}
+
+static void downgrade_others(Multicore *mc, int core, unsigned long long block, DirEntry *dir)
+{
+	for (int c = 0; c < mc->ncores; ++c) {
+		if (c == core || !(dir->sharers & (1u << c)))
+			continue;
+		Line *line = lookup_line(&mc->l1[c], block);
+		if (line == NULL || line->state == MESI_S)
+			continue;
+		if (line->state == MESI_M)
+			mc->writebacks++;
+		line->state = MESI_S;
+		mc->interventions++;
+	}
+}
+
+static void note_write(DirEntry *dir, int core, int offset)
+{
+	if (dir->last_writer && dir->last_writer != core + 1 && dir->last_offset != offset)
+		dir->false_sharing++;
+	dir->last_writer = core + 1;
+	dir->last_offset = offset;
+	dir->writers |= 1u << core;
+}
+
+// fills tag into set with the given state, evicting the LRU line if needed
+static void fill_line(Multicore *mc, int core, Set *set, int index, unsigned long long tag, int state)
+{
+	Cache *l1 = &mc->l1[core];
+	int i;
+	for (i = 0; i < set->E; ++i)
+		if (!set->lines[i].valid)
+			break;
+	if (i == set->E) {
+		i = set->lru_queue[0];
+		Line *victim = &set->lines[i];
+		mc->l1_result[core].evictions++;
+		if (victim->state == MESI_M)
+			mc->writebacks++;
+		DirEntry *dir = addr_map_get(&mc->directory, block_of(l1, victim->tag, index), 0);
+		if (dir != NULL)
+			dir->sharers &= ~(1u << core);
+	}
+	set->lines[i].valid = 1;
+	set->lines[i].tag = tag;
+	set->lines[i].state = state;
+	set->lines[i].invalidated = 0;
+	update_lru_queue(set->lru_queue, i, set->E);
+}
+
+int coherent_ref(Multicore *mc, int core, unsigned long long address, int store)
+{
+	Cache *l1 = &mc->l1[core];
+	unsigned long long block = address >> l1->b;
+	unsigned long long tag;
+	int index = set_of(l1, block, &tag);
+	Set *set = &l1->sets[index];
+
+	DirEntry *dir;
+	if ((dir = addr_map_get(&mc->directory, block, 1)) == NULL)
+		return -1;
+	if (store)
+		note_write(dir, core, address & ((1ULL << l1->b) - 1));
+
+	int i = find_line(set, tag);
+	if (i != -1) {
+		mc->l1_result[core].hits++;
+		update_lru_queue(set->lru_queue, i, set->E);
+		if (store && set->lines[i].state == MESI_S) {
+			mc->upgrades++;
+			invalidate_others(mc, core, block, dir);
+		}
+		if (store)
+			set->lines[i].state = MESI_M;
+		return 0;
+	}
+
+	mc->l1_result[core].misses++;
+	if (was_invalidated(set, tag))
+		mc->sharing_misses[core]++;
+	int state;
+	if (store) {
+		invalidate_others(mc, core, block, dir);
+		state = MESI_M;
+	} else if (dir->sharers & ~(1u << core)) {
+		downgrade_others(mc, core, block, dir);
+		state = MESI_S;
+	} else
+		state = MESI_E;
+	ref_mem(&mc->llc, address, &mc->llc_result);
+	fill_line(mc, core, set, index, tag, state);
+	dir->sharers |= 1u << core;
+	return 0;
+}
+
+// index of the trace to take the next reference from, or -1 once all are
+// drained. round-robin unless by_time, in which case the earliest timestamp
+// goes first (ties to the lower trace)
+int next_trace(Trace *traces, size_t *pos, int n, int *turn, int by_time)
+{
+	int next = -1;
+	for (int k = 0; k < n; ++k) {
+		int t = (*turn + k) % n;
+		if (pos[t] == traces[t].n)
+			continue;
+		if (!by_time) {
+			next = t;
+			break;
+		}
+		if (next == -1 || traces[t].refs[pos[t]].time < traces[next].refs[pos[next]].time ||
+		    (traces[t].refs[pos[t]].time == traces[next].refs[pos[next]].time && t < next))
+			next = t;
+	}
+	if (next != -1)
+		*turn = (next + 1) % n;
+	return next;
+}
+
+void free_traces(Trace *traces, int n)
+{
+	for (int t = 0; t < n; ++t)
+		free(traces[t].refs);
+}
+
+struct csim {
+	Cache cache;
+	Result result;
+	Cache l2;
+	Result l2_result;
+	Victim victim;
+	int has_l2;
+	int has_victim;
+};
+
+csim_t *csim_create(const csim_config_t *config)
+{
+	Config cache_config;
+	csim_t *sim;
+	if (build_config(&cache_config, config->s, config->E, config->b) == -1)
+		return NULL;
+	if (config->sets && configure_sets(&cache_config, config->sets) == -1)
+		return NULL;
+	if ((sim = (csim_t *) calloc(1, sizeof(csim_t))) == NULL)
+		return NULL;
+	if (allocate_cache(&sim->cache, &cache_config) == -1) {
+		free(sim);
+		return NULL;
+	}
+	sim->cache.split = config->split;
+	if (config->l2_E) {
+		Config l2_config;
+		if (build_config(&l2_config, config->l2_s, config->l2_E, config->l2_b) == -1 ||
+		    allocate_cache(&sim->l2, &l2_config) == -1) {
+			csim_destroy(sim);
+			return NULL;
+		}
+		sim->has_l2 = 1;
+		sim->cache.next = &sim->l2;
+		sim->cache.next_result = &sim->l2_result;
+	}
+	if (config->victim_entries) {
+		if (allocate_victim(&sim->victim, config->victim_entries, config->b, 0) == -1) {
+			csim_destroy(sim);
+			return NULL;
+		}
+		sim->has_victim = 1;
+		sim->cache.victim = &sim->victim;
+	}
+	return sim;
+}
+
+void csim_destroy(csim_t *sim)
+{
+	if (sim == NULL)
+		return;
+	deallocate_cache(&sim->cache);
+	if (sim->has_l2)
+		deallocate_cache(&sim->l2);
+	if (sim->has_victim)
+		deallocate_cache(&sim->victim.buf);
+	free(sim);
+}
+
+int csim_access(csim_t *sim, unsigned long long address, char op)
+{
+	if (op == 'I')
+		return REF_HIT;
+	int outcome = ref_mem(&sim->cache, address, &sim->result);
+	if (op == 'M')
+		ref_mem(&sim->cache, address, &sim->result);
+	return outcome;
+}
+
+// feeds ref through run, the pending run of references to one block, as
+// csim's streaming loop does
+static void feed_ref(csim_t *sim, Ref *ref, Ref *run, int *pending)
+{
+	Cache *cache = &sim->cache;
+	if (*pending && (run->address >> cache->b) == (ref->address >> cache->b) &&
+	    single_block(cache, ref, cache->b)) {
+		fold_ref(run, ref);
+		return;
+	}
+	if (*pending)
+		replay_ref(cache, run, &sim->result);
+	*run = *ref;
+	run->repeat = 0;
+	*pending = single_block(cache, run, cache->b);
+	if (!*pending)
+		replay_ref(cache, run, &sim->result);
+}
+
+void csim_access_batch(csim_t *sim, const csim_ref_t *refs, size_t n)
+{
+	Ref ref = {0};
+	Ref run;
+	int pending = 0;
+	ref.count = 1;
+	for (size_t i = 0; i < n; ++i) {
+		if (refs[i].op == 'I')
+			continue;
+		ref.address = refs[i].address;
+		ref.op = refs[i].op;
+		ref.size = refs[i].size;
+		feed_ref(sim, &ref, &run, &pending);
+	}
+	if (pending)
+		replay_ref(&sim->cache, &run, &sim->result);
+}
+
+int csim_access_file(csim_t *sim, const char *trace_file_path)
+{
+	TraceReader reader;
+	if (open_trace(&reader, trace_file_path) == -1)
+		return -1;
+	Ref ref;
+	Ref run;
+	int pending = 0;
+	while (read_ref(&reader, &ref))
+		if (ref.op != 'I')
+			feed_ref(sim, &ref, &run, &pending);
+	if (pending)
+		replay_ref(&sim->cache, &run, &sim->result);
+	close_trace(&reader);
+	return 0;
+}
+
+int csim_load_refs(const char *trace_file_path, csim_ref_t **refs, size_t *n)
+{
+	TraceReader reader;
+	if (open_trace(&reader, trace_file_path) == -1)
+		return -1;
+	size_t cap = 4096;
+	*n = 0;
+	if ((*refs = (csim_ref_t *) malloc(cap * sizeof(csim_ref_t))) == NULL) {
+		close_trace(&reader);
+		return -1;
+	}
+	Ref ref;
+	while (read_ref(&reader, &ref)) {
+		if (ref.op == 'I')
+			continue;
+		if (*n == cap) {
+			cap *= 2;
+			csim_ref_t *grown = (csim_ref_t *) realloc(*refs, cap * sizeof(csim_ref_t));
+			if (grown == NULL) {
+				close_trace(&reader);
+				return -1;
+			}
+			*refs = grown;
+		}
+		(*refs)[*n].address = ref.address;
+		(*refs)[*n].op = ref.op;
+		(*refs)[*n].size = ref.size;
+		(*n)++;
+	}
+	close_trace(&reader);
+	return 0;
+}
+
+void csim_stats(const csim_t *sim, csim_stats_t *stats)
+{
+	memset(stats, 0, sizeof(csim_stats_t));
+	stats->hits = sim->result.hits;
+	stats->misses = sim->result.misses;
+	stats->evictions = sim->result.evictions;
+	if (sim->has_l2) {
+		stats->l2_hits = sim->l2_result.hits;
+		stats->l2_misses = sim->l2_result.misses;
+		stats->l2_evictions = sim->l2_result.evictions;
+	}
+	if (sim->has_victim)
+		stats->victim_hits = sim->victim.hits;
+}
+
+// result cache layout: <dir>/index holds "hash sample size mtime dev inode
+// path" per trace seen, keyed by device and inode, with mtime in nanoseconds
+// and path made absolute; <dir>/<hash> holds "sample hits misses evictions
+// l2_hits l2_misses l2_evictions victim_hits config" per config simulated on
+// those contents. results outlive the index entry that led to them, since
+// another trace may still have those contents; csim_cache_prune() drops them
+#define CACHE_PATH_MAX 4096
+
+// bytes hashed at a time, and the blocks of a trace sampled on every lookup
+#define HASH_BLOCK (1 << 16)
+#define SAMPLE_BLOCKS 16
+#define SAMPLE_BYTES 4096
+
+typedef struct {
+	unsigned long long hash;    // of the whole contents, names the result file
+	unsigned long long sample;  // of the size and SAMPLE_BLOCKS blocks spread over the file
+	unsigned long long size;
+	unsigned long long mtime;
+	unsigned long long dev;
+	unsigned long long ino;
+	char *path;
+} IndexEntry;
+
+// mixes n bytes into h a 64-bit word at a time
+static unsigned long long hash_bytes(unsigned long long h, const unsigned char *bytes, size_t n)
+{
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		unsigned long long word;
+		memcpy(&word, &bytes[i], 8);
+		h = (h ^ word) * 0x9e3779b97f4a7c15ULL;
+		h ^= h >> 32;
+	}
+	for (; i < n; ++i)
+		h = (h ^ bytes[i]) * 1099511628211ULL;
+	return h;
+}
+
+// the whole file, read in blocks of HASH_BLOCK
+static int hash_file(const char *path, unsigned long long *hash)
+{
+	FILE *file;
+	unsigned char block[HASH_BLOCK];
+	size_t n;
+	if ((file = fopen(path, "rb")) == NULL)
+		return -1;
+	*hash = 14695981039346656037ULL;
+	while ((n = fread(block, 1, sizeof(block), file)) > 0)
+		*hash = hash_bytes(*hash, block, n);
+	fclose(file);
+	return 0;
+}
+
+// size plus SAMPLE_BLOCKS blocks of SAMPLE_BYTES from the start to the end
+// of the file, cheap enough to check on every lookup: an index entry whose
+// size and mtime still match can then only be stale for a rewrite that
+// touched none of the sampled blocks
+static int sample_file(const char *path, unsigned long long size, unsigned long long *sample)
+{
+	unsigned char block[SAMPLE_BYTES];
+	int fd;
+	if ((fd = open(path, O_RDONLY)) == -1)
+		return -1;
+	*sample = hash_bytes(14695981039346656037ULL, (const unsigned char *) &size, sizeof(size));
+	for (int i = 0; i < SAMPLE_BLOCKS; ++i) {
+		unsigned long long offset = size > SAMPLE_BYTES ?
+		                            (size - SAMPLE_BYTES) / (SAMPLE_BLOCKS - 1) * i : 0;
+		ssize_t n = pread(fd, block, sizeof(block), (off_t) offset);
+		if (n < 0) {
+			close(fd);
+			return -1;
+		}
+		*sample = hash_bytes(*sample, block, (size_t) n);
+		if (size <= SAMPLE_BYTES)
+			break;
+	}
+	close(fd);
+	return 0;
+}
+
+// the mtime an index entry records for st. a file modified within the
+// current second may be modified again without its mtime changing on file
+// systems with coarse timestamps, so it is recorded as 0, which never matches
+// and has the next lookup rehash it
+static unsigned long long index_mtime(const struct stat *st)
+{
+	if (st->st_mtim.tv_sec >= time(NULL))
+		return 0;
+	return (unsigned long long) st->st_mtim.tv_sec * 1000000000ULL + st->st_mtim.tv_nsec;
+}
+
+// an entry for the trace at path as it is now, all but its hash; free
+// entry->path when done
+static int describe_trace(const char *path, IndexEntry *entry)
+{
+	struct stat st;
+	if (stat(path, &st) == -1 || (entry->path = realpath(path, NULL)) == NULL)
+		return -1;
+	entry->size = (unsigned long long) st.st_size;
+	entry->mtime = index_mtime(&st);
+	entry->dev = (unsigned long long) st.st_dev;
+	entry->ino = (unsigned long long) st.st_ino;
+	if (sample_file(path, entry->size, &entry->sample) == -1) {
+		free(entry->path);
+		return -1;
+	}
+	return 0;
+}
+
+// whether an index entry still describes the trace now described by current
+static int entry_current(const IndexEntry *entry, const IndexEntry *current)
+{
+	return entry->dev == current->dev && entry->ino == current->ino &&
+	       entry->size == current->size && entry->mtime != 0 &&
+	       entry->mtime == current->mtime && entry->sample == current->sample;
+}
+
+// splits an index line into entry's fields, pointing entry->path into line
+static int parse_index_line(char *line, IndexEntry *entry)
+{
+	int pos;
+	if (sscanf(line, "%llx %llx %llu %llu %llu %llu %n", &entry->hash, &entry->sample,
+	           &entry->size, &entry->mtime, &entry->dev, &entry->ino, &pos) != 6)
+		return -1;
+	line[strcspn(line, "\n")] = '\0';
+	entry->path = &line[pos];
+	return 0;
+}
+
+static void print_index_line(FILE *file, const IndexEntry *entry)
+{
+	fprintf(file, "%016llx %016llx %llu %llu %llu %llu %s\n", entry->hash, entry->sample,
+	        entry->size, entry->mtime, entry->dev, entry->ino, entry->path);
+}
+
+// a new index is written to a file of its own and renamed over the old one,
+// so concurrent writers never interleave and readers see one or the other
+static FILE *create_index(const char *dir, char *tmp_path, size_t len)
+{
+	int fd;
+	FILE *tmp;
+	snprintf(tmp_path, len, "%s/index.XXXXXX", dir);
+	if ((fd = mkstemp(tmp_path)) == -1)
+		return NULL;
+	if ((tmp = fdopen(fd, "w")) == NULL) {
+		close(fd);
+		remove(tmp_path);
+	}
+	return tmp;
+}
+
+static int replace_index(const char *dir, FILE *tmp, const char *tmp_path)
+{
+	char index_path[CACHE_PATH_MAX];
+	snprintf(index_path, sizeof(index_path), "%s/index", dir);
+	if (fclose(tmp) != 0 || rename(tmp_path, index_path) != 0) {
+		remove(tmp_path);
+		return -1;
+	}
+	return 0;
+}
+
+// the content hash and sample of trace_file_path, from the index while the
+// entry for its device and inode still matches. otherwise the trace is
+// rehashed, and its entry, and any other entry for the same path, replaced
+static int trace_hash(const char *dir, const char *trace_file_path, unsigned long long *hash,
+                      unsigned long long *sample)
+{
+	char index_path[CACHE_PATH_MAX], tmp_path[CACHE_PATH_MAX], line[CACHE_PATH_MAX + 128];
+	FILE *index, *tmp;
+	IndexEntry current, entry;
+	if (mkdir(dir, 0777) == -1 && errno != EEXIST)
+		return -1;
+	if (describe_trace(trace_file_path, &current) == -1)
+		return -1;
+	*sample = current.sample;
+	snprintf(index_path, sizeof(index_path), "%s/index", dir);
+	if ((index = fopen(index_path, "r")) != NULL) {
+		while (fgets(line, sizeof(line), index) != NULL)
+			if (parse_index_line(line, &entry) == 0 && entry_current(&entry, &current)) {
+				fclose(index);
+				free(current.path);
+				*hash = entry.hash;
+				return 0;
+			}
+		fclose(index);
+	}
+	if (hash_file(trace_file_path, &current.hash) == -1) {
+		free(current.path);
+		return -1;
+	}
+	*hash = current.hash;
+
+	// copy the index without this trace's entries, then append the new one
+	if ((tmp = create_index(dir, tmp_path, sizeof(tmp_path))) == NULL) {
+		free(current.path);
+		return -1;
+	}
+	if ((index = fopen(index_path, "r")) != NULL) {
+		while (fgets(line, sizeof(line), index) != NULL)
+			if (parse_index_line(line, &entry) == 0 &&
+			    (entry.dev != current.dev || entry.ino != current.ino) &&
+			    strcmp(entry.path, current.path) != 0)
+				print_index_line(tmp, &entry);
+		fclose(index);
+	}
+	print_index_line(tmp, &current);
+	free(current.path);
+	return replace_index(dir, tmp, tmp_path);
+}
+
+// a result file name: 16 hex digits
+static int is_result_file(const char *name, unsigned long long *hash)
+{
+	if (strlen(name) != 16 || strspn(name, "0123456789abcdef") != 16)
+		return 0;
+	*hash = strtoull(name, NULL, 16);
+	return 1;
+}
+
+static int compare_hashes(const void *a, const void *b)
+{
+	unsigned long long x = *(const unsigned long long *) a, y = *(const unsigned long long *) b;
+	return (x > y) - (x < y);
+}
+
+int csim_cache_prune(const char *dir)
+{
+	char index_path[CACHE_PATH_MAX], tmp_path[CACHE_PATH_MAX], line[CACHE_PATH_MAX + 128];
+	FILE *index, *tmp;
+	unsigned long long h, *live = NULL;
+	size_t nlive = 0, cap = 0;
+	IndexEntry entry, current;
+	int removed = 0;
+
+	// keep the entries of traces that are still there as they were indexed
+	snprintf(index_path, sizeof(index_path), "%s/index", dir);
+	if ((tmp = create_index(dir, tmp_path, sizeof(tmp_path))) == NULL)
+		return -1;
+	if ((index = fopen(index_path, "r")) != NULL) {
+		while (fgets(line, sizeof(line), index) != NULL) {
+			if (parse_index_line(line, &entry) == -1 || describe_trace(entry.path, &current) == -1)
+				continue;
+			free(current.path);
+			// a racy entry (mtime 0) is kept while the rest still matches
+			if (entry.mtime == 0)
+				current.mtime = 0;
+			if (entry.dev != current.dev || entry.ino != current.ino ||
+			    entry.size != current.size || entry.mtime != current.mtime ||
+			    entry.sample != current.sample)
+				continue;
+			if (nlive == cap) {
+				cap = cap ? 2 * cap : 64;
+				unsigned long long *grown = (unsigned long long *) realloc(live, cap * sizeof(*live));
+				if (grown == NULL) {
+					fclose(index);
+					fclose(tmp);
+					remove(tmp_path);
+					free(live);
+					return -1;
+				}
+				live = grown;
+			}
+			live[nlive++] = entry.hash;
+			print_index_line(tmp, &entry);
+		}
+		fclose(index);
+	}
+	if (replace_index(dir, tmp, tmp_path) == -1) {
+		free(live);
+		return -1;
+	}
+
+	// then every result file no entry leads to
+	DIR *entries = opendir(dir);
+	struct dirent *dirent;
+	if (entries == NULL) {
+		free(live);
+		return -1;
+	}
+	qsort(live, nlive, sizeof(*live), compare_hashes);
+	while ((dirent = readdir(entries)) != NULL) {
+		if (!is_result_file(dirent->d_name, &h) ||
+		    (nlive && bsearch(&h, live, nlive, sizeof(*live), compare_hashes) != NULL))
+			continue;
+		snprintf(tmp_path, sizeof(tmp_path), "%s/%s", dir, dirent->d_name);
+		if (remove(tmp_path) == 0)
+			++removed;
+	}
+	closedir(entries);
+	free(live);
+	return removed;
+}
+
+int csim_cache_lookup(const char *dir, const char *trace_file_path, const char *config_key,
+                      csim_stats_t *stats)
+{
+	unsigned long long hash, sample, line_sample;
+	char path[CACHE_PATH_MAX], line[1024];
+	FILE *file;
+	if (trace_hash(dir, trace_file_path, &hash, &sample) == -1)
+		return -1;
+	snprintf(path, sizeof(path), "%s/%016llx", dir, hash);
+	if ((file = fopen(path, "r")) == NULL)
+		return 0;
+	while (fgets(line, sizeof(line), file) != NULL) {
+		int pos;
+		if (sscanf(line, "%llx %llu %llu %llu %llu %llu %llu %llu %n", &line_sample,
+		           &stats->hits, &stats->misses, &stats->evictions, &stats->l2_hits,
+		           &stats->l2_misses, &stats->l2_evictions, &stats->victim_hits, &pos) != 8)
+			continue;
+		line[strcspn(line, "\n")] = '\0';
+		// results recorded for other contents that hashed alike are not ours
+		if (line_sample == sample && strcmp(&line[pos], config_key) == 0) {
+			fclose(file);
+			return 1;
+		}
+	}
+	fclose(file);
+	return 0;
+}
+
+int csim_cache_store(const char *dir, const char *trace_file_path, const char *config_key,
+                     const csim_stats_t *stats)
+{
+	unsigned long long hash, sample;
+	char path[CACHE_PATH_MAX];
+	FILE *file;
+	if (trace_hash(dir, trace_file_path, &hash, &sample) == -1)
+		return -1;
+	snprintf(path, sizeof(path), "%s/%016llx", dir, hash);
+	if ((file = fopen(path, "a")) == NULL)
+		return -1;
+	fprintf(file, "%016llx %llu %llu %llu %llu %llu %llu %llu %s\n", sample, stats->hits,
+	        stats->misses, stats->evictions, stats->l2_hits, stats->l2_misses,
+	        stats->l2_evictions, stats->victim_hits, config_key);
+	return fclose(file) == 0 ? 0 : -1;
+}
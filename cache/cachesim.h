@@ -0,0 +1,100 @@
+/*
+ * cachesim.h - Cache models behind csim, usable in-process by other tools
+ *
+ * The csim_* functions below are the stable interface: an opaque simulator
+ * built from a csim_config_t that is fed references one at a time or in
+ * batches. The model types that csim itself composes into its various modes
+ * are in cachesim-internal.h, and may change along with csim.
+ */
+#ifndef CACHESIM_H
+#define CACHESIM_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct csim csim_t;
+
+typedef struct {
+	int s;               // number of set index bits
+	int E;               // number of lines per set
+	int b;               // number of block offset bits
+	int sets;            // 0, or an explicit (possibly non-power-of-two) set count
+	int split;           // split accesses that straddle a block boundary
+	int victim_entries;  // 0, or the size of a victim cache beside the cache
+	int l2_E;            // 0, or the lines per set of a second level...
+	int l2_s;            // ...with this many set index bits...
+	int l2_b;            // ...and this many block offset bits
+} csim_config_t;
+
+typedef struct csim_ref {
+	unsigned long long address;
+	char op;   // 'L', 'S' or 'M'; 'I' records are ignored
+	int size;  // bytes accessed, only used with split
+} csim_ref_t;
+
+// besides Valgrind's text format, every trace reader accepts a binary format:
+// the 8 bytes of CSIM_TRACE_MAGIC followed by csim_record_t in native byte
+// order, with no other framing
+#define CSIM_TRACE_MAGIC "CSIMTRC1"
+
+typedef struct {
+	unsigned long long address;
+	unsigned int size;
+	char op;  // 'I', 'L', 'S' or 'M'
+	char pad[3];
+} csim_record_t;
+
+typedef struct {
+	unsigned long long hits;
+	unsigned long long misses;
+	unsigned long long evictions;
+	unsigned long long l2_hits;
+	unsigned long long l2_misses;
+	unsigned long long l2_evictions;
+	unsigned long long victim_hits;
+} csim_stats_t;
+
+// csim_access() outcome bits; an access that hits returns REF_HIT
+enum {
+	REF_HIT = 0,
+	REF_MISS = 1,
+	REF_EVICTION = 2,
+	REF_NEXT_MISS = 4,  // the miss also missed in the next level
+	REF_VICTIM_HIT = 8, // the miss was served by the victim/miss cache
+};
+
+// returns NULL if the configuration is invalid or allocation fails
+csim_t *csim_create(const csim_config_t *config);
+void csim_destroy(csim_t *sim);
+// one access of one byte; returns the REF_* outcome of its (first) lookup
+int csim_access(csim_t *sim, unsigned long long address, char op);
+void csim_access_batch(csim_t *sim, const csim_ref_t *refs, size_t n);
+// replays a Valgrind trace file; returns -1 if it cannot be read
+int csim_access_file(csim_t *sim, const char *trace_file_path);
+// decodes the data references of a Valgrind trace file once, for replaying
+// into any number of simulators; free *refs when done
+int csim_load_refs(const char *trace_file_path, csim_ref_t **refs, size_t *n);
+void csim_stats(const csim_t *sim, csim_stats_t *stats);
+
+// a directory of results keyed by trace contents and a caller-chosen
+// canonical config string. a trace (by device and inode) is rehashed only
+// when its size, mtime or a sample of its blocks changed; results for its old
+// contents stay until pruned.
+// lookup returns 1 and fills stats on a hit, 0 on a miss, -1 on error
+int csim_cache_lookup(const char *dir, const char *trace_file_path, const char *config_key,
+                      csim_stats_t *stats);
+int csim_cache_store(const char *dir, const char *trace_file_path, const char *config_key,
+                     const csim_stats_t *stats);
+// forgets traces that were removed or changed since they were indexed, and
+// deletes the results no indexed trace has; returns the number of result
+// files deleted, or -1 on error
+int csim_cache_prune(const char *dir);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CACHESIM_H */
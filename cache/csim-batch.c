@@ -0,0 +1,416 @@
+/*
+ * csim-batch.c - Runs every configuration of a job file on every trace
+ *
+ * Each trace is decoded once and shared read-only by all of its jobs, which
+ * a pool of threads works through, stealing from each other when their own
+ * queue runs dry. Results come out as one CSV or JSON table, in job file
+ * order.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include "cachesim.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MAX_THREADS 64
+#define LINE_SIZE 4096
+
+typedef struct {
+	char *path;
+	csim_ref_t *refs;
+	size_t n;
+} BatchTrace;
+
+typedef struct {
+	char *spec;  // as written in the job file, for the output table
+	csim_config_t config;
+} BatchConfig;
+
+typedef struct {
+	BatchTrace *traces;
+	int ntraces;
+	BatchConfig *configs;
+	int nconfigs;
+} JobFile;
+
+// job j simulates configs[j % nconfigs] on traces[j / nconfigs]
+typedef struct {
+	int failed;
+	csim_stats_t stats;
+} JobResult;
+
+// a worker's share of the jobs. the owner takes from the tail, thieves from
+// the head, so they only meet on the last job
+typedef struct {
+	int *jobs;
+	int head;
+	int tail;
+	pthread_mutex_t lock;
+} Deque;
+
+typedef struct {
+	JobFile *jobs;
+	JobResult *results;
+	Deque *deques;
+	int nthreads;
+} Pool;
+
+typedef struct {
+	Pool *pool;
+	int id;
+} Worker;
+
+char *copy_string(const char *str)
+{
+	char *copy = (char *) malloc(strlen(str) + 1);
+	if (copy != NULL)
+		strcpy(copy, str);
+	return copy;
+}
+
+// parses "<s>,<E>,<b> [split] [sets=<n>] [victim=<n>] [l2=<s>,<E>,<b>]"
+int parse_config(char *spec, csim_config_t *config)
+{
+	char extra;
+	char *token = strtok(spec, " \t");
+	memset(config, 0, sizeof(csim_config_t));
+	if (token == NULL || sscanf(token, "%d,%d,%d%c", &config->s, &config->E, &config->b, &extra) != 3)
+		return -1;
+	while ((token = strtok(NULL, " \t")) != NULL) {
+		if (strcmp(token, "split") == 0)
+			config->split = 1;
+		else if (sscanf(token, "sets=%d%c", &config->sets, &extra) == 1 && config->sets > 0)
+			continue;
+		else if (sscanf(token, "victim=%d%c", &config->victim_entries, &extra) == 1 &&
+		         config->victim_entries > 0)
+			continue;
+		else if (sscanf(token, "l2=%d,%d,%d%c", &config->l2_s, &config->l2_E, &config->l2_b,
+		                &extra) == 3 && config->l2_E > 0)
+			continue;
+		else
+			return -1;
+	}
+	// reject what csim_create() would, before any trace is read
+	csim_t *sim = csim_create(config);
+	if (sim == NULL)
+		return -1;
+	csim_destroy(sim);
+	return 0;
+}
+
+// a job file has "trace <path>" and "config <spec>" lines in any order;
+// blank lines and lines starting with '#' are ignored
+int load_job_file(JobFile *jobs, const char *path)
+{
+	FILE *file;
+	char line[LINE_SIZE];
+	int line_no = 0;
+	memset(jobs, 0, sizeof(JobFile));
+	if ((file = fopen(path, "r")) == NULL)
+		return -1;
+	while (fgets(line, sizeof(line), file) != NULL) {
+		char *arg;
+		line_no++;
+		line[strcspn(line, "\r\n")] = '\0';
+		if (line[0] == '\0' || line[0] == '#')
+			continue;
+		if (strncmp(line, "trace ", 6) == 0) {
+			BatchTrace *grown = (BatchTrace *) realloc(jobs->traces,
+			                    (jobs->ntraces + 1) * sizeof(BatchTrace));
+			if (grown == NULL)
+				break;
+			jobs->traces = grown;
+			for (arg = line + 6; *arg == ' '; ++arg)
+				;
+			memset(&jobs->traces[jobs->ntraces], 0, sizeof(BatchTrace));
+			if ((jobs->traces[jobs->ntraces++].path = copy_string(arg)) == NULL)
+				break;
+		} else if (strncmp(line, "config ", 7) == 0) {
+			BatchConfig *grown = (BatchConfig *) realloc(jobs->configs,
+			                     (jobs->nconfigs + 1) * sizeof(BatchConfig));
+			if (grown == NULL)
+				break;
+			jobs->configs = grown;
+			for (arg = line + 7; *arg == ' '; ++arg)
+				;
+			BatchConfig *config = &jobs->configs[jobs->nconfigs];
+			if ((config->spec = copy_string(arg)) == NULL)
+				break;
+			jobs->nconfigs++;
+			if (parse_config(arg, &config->config) == -1) {
+				fprintf(stderr, "%s:%d: invalid config \"%s\"\n", path, line_no, config->spec);
+				break;
+			}
+		} else {
+			fprintf(stderr, "%s:%d: expected \"trace <path>\" or \"config <spec>\"\n",
+			        path, line_no);
+			break;
+		}
+	}
+	int complete = feof(file);
+	fclose(file);
+	return complete ? 0 : -1;
+}
+
+void free_job_file(JobFile *jobs)
+{
+	for (int t = 0; t < jobs->ntraces; ++t) {
+		free(jobs->traces[t].path);
+		free(jobs->traces[t].refs);
+	}
+	for (int c = 0; c < jobs->nconfigs; ++c)
+		free(jobs->configs[c].spec);
+	free(jobs->traces);
+	free(jobs->configs);
+}
+
+void run_job(JobFile *jobs, int job, JobResult *result)
+{
+	BatchTrace *trace = &jobs->traces[job / jobs->nconfigs];
+	csim_t *sim = csim_create(&jobs->configs[job % jobs->nconfigs].config);
+	if (sim == NULL) {
+		result->failed = 1;
+		return;
+	}
+	csim_access_batch(sim, trace->refs, trace->n);
+	csim_stats(sim, &result->stats);
+	csim_destroy(sim);
+}
+
+// the next job for worker id: its own newest, else the oldest of another's
+int take_job(Pool *pool, int id)
+{
+	int job = -1;
+	Deque *own = &pool->deques[id];
+	pthread_mutex_lock(&own->lock);
+	if (own->tail > own->head)
+		job = own->jobs[--own->tail];
+	pthread_mutex_unlock(&own->lock);
+	for (int i = 1; job == -1 && i < pool->nthreads; ++i) {
+		Deque *victim = &pool->deques[(id + i) % pool->nthreads];
+		pthread_mutex_lock(&victim->lock);
+		if (victim->tail > victim->head)
+			job = victim->jobs[victim->head++];
+		pthread_mutex_unlock(&victim->lock);
+	}
+	return job;
+}
+
+void *worker_main(void *arg)
+{
+	Worker *worker = (Worker *) arg;
+	int job;
+	// no job creates others, so once every deque is empty the batch is done
+	while ((job = take_job(worker->pool, worker->id)) != -1)
+		run_job(worker->pool->jobs, job, &worker->pool->results[job]);
+	return NULL;
+}
+
+int run_pool(JobFile *jobs, JobResult *results, int nthreads)
+{
+	int njobs = jobs->ntraces * jobs->nconfigs;
+	Deque deques[MAX_THREADS];
+	Worker workers[MAX_THREADS];
+	pthread_t threads[MAX_THREADS];
+	Pool pool = {jobs, results, deques, nthreads};
+	int allocated = 1, started = 0;
+
+	// deal jobs round-robin so every worker starts on a different trace/config
+	for (int i = 0; i < nthreads; ++i) {
+		deques[i].head = 0;
+		deques[i].tail = 0;
+		pthread_mutex_init(&deques[i].lock, NULL);
+		if ((deques[i].jobs = (int *) malloc((njobs / nthreads + 1) * sizeof(int))) == NULL)
+			allocated = 0;
+	}
+	for (int j = allocated ? njobs - 1 : -1; j >= 0; --j)
+		deques[j % nthreads].jobs[deques[j % nthreads].tail++] = j;
+
+	for (; allocated && started < nthreads; ++started) {
+		workers[started].pool = &pool;
+		workers[started].id = started;
+		if (pthread_create(&threads[started], NULL, worker_main, &workers[started]) != 0)
+			break;
+	}
+	// a worker that failed to start leaves its jobs to be stolen by the rest
+	for (int i = 0; i < started; ++i)
+		pthread_join(threads[i], NULL);
+	for (int i = 0; i < nthreads; ++i) {
+		pthread_mutex_destroy(&deques[i].lock);
+		free(deques[i].jobs);
+	}
+	return started > 0 ? 0 : -1;
+}
+
+// prints str as a JSON string literal, escaping quotes, backslashes and the
+// control characters JSON forbids raw (RFC 8259)
+void print_json_string(FILE *out, const char *str)
+{
+	fputc('"', out);
+	for (; *str; ++str) {
+		unsigned char c = (unsigned char) *str;
+		switch (c) {
+		case '"':
+			fputs("\\\"", out);
+			break;
+		case '\\':
+			fputs("\\\\", out);
+			break;
+		case '\n':
+			fputs("\\n", out);
+			break;
+		case '\t':
+			fputs("\\t", out);
+			break;
+		case '\r':
+			fputs("\\r", out);
+			break;
+		case '\b':
+			fputs("\\b", out);
+			break;
+		case '\f':
+			fputs("\\f", out);
+			break;
+		default:
+			if (c < 0x20)
+				fprintf(out, "\\u%04x", c);
+			else
+				fputc(c, out);
+		}
+	}
+	fputc('"', out);
+}
+
+// prints str as a quoted CSV field, doubling any quotes in it (RFC 4180)
+void print_csv_string(FILE *out, const char *str)
+{
+	fputc('"', out);
+	for (; *str; ++str) {
+		if (*str == '"')
+			fputc('"', out);
+		fputc(*str, out);
+	}
+	fputc('"', out);
+}
+
+void print_results(FILE *out, JobFile *jobs, JobResult *results, int json)
+{
+	int njobs = jobs->ntraces * jobs->nconfigs, printed = 0;
+	if (json)
+		fprintf(out, "[");
+	else
+		fprintf(out, "trace,config,refs,hits,misses,evictions,"
+		        "l2_hits,l2_misses,l2_evictions,victim_hits\n");
+	for (int j = 0; j < njobs; ++j) {
+		BatchTrace *trace = &jobs->traces[j / jobs->nconfigs];
+		BatchConfig *config = &jobs->configs[j % jobs->nconfigs];
+		csim_stats_t *stats = &results[j].stats;
+		if (results[j].failed)
+			continue;
+		if (json) {
+			fprintf(out, "%s\n  {\"trace\": ", printed++ ? "," : "");
+			print_json_string(out, trace->path);
+			fprintf(out, ", \"config\": ");
+			print_json_string(out, config->spec);
+			fprintf(out, ", \"refs\": %zu, \"hits\": %llu, \"misses\": %llu, \"evictions\": %llu, "
+			        "\"l2_hits\": %llu, \"l2_misses\": %llu, \"l2_evictions\": %llu, "
+			        "\"victim_hits\": %llu}", trace->n, stats->hits, stats->misses,
+			        stats->evictions, stats->l2_hits, stats->l2_misses, stats->l2_evictions,
+			        stats->victim_hits);
+		} else {
+			print_csv_string(out, trace->path);
+			fputc(',', out);
+			print_csv_string(out, config->spec);
+			fprintf(out, ",%zu,%llu,%llu,%llu,%llu,%llu,%llu,%llu\n", trace->n, stats->hits,
+			        stats->misses, stats->evictions, stats->l2_hits, stats->l2_misses,
+			        stats->l2_evictions, stats->victim_hits);
+		}
+	}
+	if (json)
+		fprintf(out, "\n]\n");
+}
+
+void usage(char *argv[])
+{
+	fprintf(stderr, "usage: %s -j <jobfile> [-p <threads>] [-f csv|json] [-o <file>]\n", argv[0]);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *job_path = NULL, *out_path = NULL;
+	int nthreads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+	int json = 0, opt;
+	while ((opt = getopt(argc, argv, "j:p:f:o:")) != -1)
+		switch (opt) {
+		case 'j':
+			job_path = optarg;
+			break;
+		case 'p':
+			nthreads = atoi(optarg);
+			if (nthreads < 1) {
+				usage(argv);
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'f':
+			if (strcmp(optarg, "json") == 0)
+				json = 1;
+			else if (strcmp(optarg, "csv") != 0) {
+				usage(argv);
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'o':
+			out_path = optarg;
+			break;
+		default:
+			usage(argv);
+			exit(EXIT_FAILURE);
+		}
+	if (job_path == NULL) {
+		usage(argv);
+		exit(EXIT_FAILURE);
+	}
+	if (nthreads < 1)
+		nthreads = 1;
+	if (nthreads > MAX_THREADS)
+		nthreads = MAX_THREADS;
+
+	JobFile jobs;
+	if (load_job_file(&jobs, job_path) == -1) {
+		fprintf(stderr, "%s: error: failed to read job file %s.\n", argv[0], job_path);
+		exit(EXIT_FAILURE);
+	}
+	for (int t = 0; t < jobs.ntraces; ++t)
+		if (csim_load_refs(jobs.traces[t].path, &jobs.traces[t].refs, &jobs.traces[t].n) == -1) {
+			fprintf(stderr, "%s: error: failed to read trace %s.\n", argv[0], jobs.traces[t].path);
+			exit(EXIT_FAILURE);
+		}
+
+	int njobs = jobs.ntraces * jobs.nconfigs;
+	if (nthreads > njobs)
+		nthreads = njobs > 0 ? njobs : 1;
+	JobResult *results = (JobResult *) calloc(njobs > 0 ? njobs : 1, sizeof(JobResult));
+	if (results == NULL || run_pool(&jobs, results, nthreads) == -1) {
+		fprintf(stderr, "%s: error: failed to run jobs.\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	for (int j = 0; j < njobs; ++j)
+		if (results[j].failed)
+			fprintf(stderr, "%s: warning: \"%s\" on %s failed.\n", argv[0],
+			        jobs.configs[j % jobs.nconfigs].spec, jobs.traces[j / jobs.nconfigs].path);
+
+	FILE *out = stdout;
+	if (out_path != NULL && (out = fopen(out_path, "w")) == NULL) {
+		fprintf(stderr, "%s: error: failed to open %s.\n", argv[0], out_path);
+		exit(EXIT_FAILURE);
+	}
+	print_results(out, &jobs, results, json);
+	if (out != stdout)
+		fclose(out);
+	free(results);
+	free_job_file(&jobs);
+	return 0;
+}
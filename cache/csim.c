@@ -1,4 +1,5 @@
 #include "cachelab.h"
+#include "cachesim-internal.h"
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -9,44 +10,66 @@
 
 int VERBOSE = 0;
 
-typedef struct {
-	int hits;
-	int misses;
-	int evictions;
-} Result;
-
 typedef struct {
 	int s;
 	int E;
 	int b;
 	const char *trace_file_path;
+	const char *trace_file_paths[MAX_TRACES];  // every -t given, in order
+	int ntraces;
+	int heat_top;  // print this many hottest sets/regions; 0 disables the heatmap
+	int region_bits;
+	const char *region_map_path;
+	int diff;  // run a second geometry in lockstep and compare outcomes
+	int diff_s;
+	int diff_E;
+	int diff_b;
+	int split;  // split references that straddle a block boundary
+	int icache; // split L1I with geometry icache_s/E/b for 'I' records
+	int icache_s;
+	int icache_E;
+	int icache_b;
+	int unified; // feed 'I' records into the data cache as well
+	int tlb_entries; // 0 disables the TLB model
+	int tlb_ways;
+	int stlb_entries; // 0: no second-level TLB
+	int stlb_ways;
+	int page_bits;
+	int mesi; // one core per trace with private L1s and a shared LLC
+	int llc_s;
+	int llc_E;
+	int llc_b;
+	int timestamps; // interleave traces by timestamp instead of round-robin
+	int corun; // every trace shares the one cache
+	unsigned int way_masks[MAX_TRACES];  // per-trace allocation masks, 0 for all ways
+	const char *index_spec;  // xor, prime or matrix:<file>; NULL for modulo
+	int sets;  // explicit (possibly non-power-of-two) number of sets
+	int l2;  // unified second level behind the data cache
+	int l2_s;
+	int l2_E;
+	int l2_b;
+	int timing;  // estimate cycles with the latencies below
+	int l1_latency;
+	int l2_latency;
+	int mem_latency;
+	int mshrs;
+	int issue_width;  // references issued per cycle
+	int victim_entries;  // 0 disables the victim/miss cache
+	int miss_cache;      // buffer missed blocks instead of evicted ones
+	int fast_forward;    // decode the trace and replay strided runs in bulk
+	const char *result_cache;  // directory of stored results, or NULL
+	const char *prune_cache;   // result cache to prune instead of simulating
+	int dram_channels;  // 0 disables the DRAM model
+	int dram_banks;
+	int dram_row_bytes;
+	int dram_policy;
+	int dram_map;
+	int sectors;  // sectors per data cache line; 0 leaves lines whole
+	int page_map;     // map data pages to frames before set indexing
+	int page_policy;
+	int page_seed;
 } Input;
 
-typedef struct {
-	int S;  // number of sets in the cache
-	int s;  // number of set selector bits
-	int E;  // number of cache lines per set
-	int b;  // number of block offset bits
-} Config;
-
-typedef struct {
-	int valid;
-	unsigned long long tag;
-} Line;
-
-typedef struct {
-	Line *lines;
-	int E;
-	int *lru_queue;
-} Set;
-
-typedef struct {
-	Set *sets;
-	int s;
-	int S;
-	int b;
-} Cache;
-
 int parse_int(char *str)
 {
 	char *end;
@@ -61,11 +84,133 @@ int parse_int(char *str)
 	return -1;
 }
 
+enum {
+	OPT_HEATMAP = 256,
+	OPT_REGION_BITS,
+	OPT_REGION_MAP,
+	OPT_DIFF,
+	OPT_SPLIT,
+	OPT_ICACHE,
+	OPT_UNIFIED,
+	OPT_TLB,
+	OPT_STLB,
+	OPT_PAGE_SIZE,
+	OPT_MESI,
+	OPT_TIMESTAMPS,
+	OPT_CORUN,
+	OPT_WAYS,
+	OPT_INDEX,
+	OPT_SETS,
+	OPT_L2,
+	OPT_TIMING,
+	OPT_MSHRS,
+	OPT_ISSUE,
+	OPT_VICTIM,
+	OPT_MISS_CACHE,
+	OPT_FAST_FORWARD,
+	OPT_RESULT_CACHE,
+	OPT_PRUNE_CACHE,
+	OPT_DRAM,
+	OPT_DRAM_POLICY,
+	OPT_DRAM_MAP,
+	OPT_SECTORS,
+	OPT_PAGE_MAP,
+	OPT_PAGE_SEED,
+};
+
+const struct option long_options[] = {
+	{"heatmap", required_argument, NULL, OPT_HEATMAP},
+	{"region-bits", required_argument, NULL, OPT_REGION_BITS},
+	{"region-map", required_argument, NULL, OPT_REGION_MAP},
+	{"diff", required_argument, NULL, OPT_DIFF},
+	{"split", no_argument, NULL, OPT_SPLIT},
+	{"icache", required_argument, NULL, OPT_ICACHE},
+	{"unified", no_argument, NULL, OPT_UNIFIED},
+	{"tlb", required_argument, NULL, OPT_TLB},
+	{"stlb", required_argument, NULL, OPT_STLB},
+	{"page-size", required_argument, NULL, OPT_PAGE_SIZE},
+	{"mesi", required_argument, NULL, OPT_MESI},
+	{"timestamps", no_argument, NULL, OPT_TIMESTAMPS},
+	{"corun", no_argument, NULL, OPT_CORUN},
+	{"ways", required_argument, NULL, OPT_WAYS},
+	{"index", required_argument, NULL, OPT_INDEX},
+	{"sets", required_argument, NULL, OPT_SETS},
+	{"l2", required_argument, NULL, OPT_L2},
+	{"timing", required_argument, NULL, OPT_TIMING},
+	{"mshrs", required_argument, NULL, OPT_MSHRS},
+	{"issue", required_argument, NULL, OPT_ISSUE},
+	{"victim", required_argument, NULL, OPT_VICTIM},
+	{"miss-cache", required_argument, NULL, OPT_MISS_CACHE},
+	{"fast-forward", no_argument, NULL, OPT_FAST_FORWARD},
+	{"result-cache", required_argument, NULL, OPT_RESULT_CACHE},
+	{"prune-cache", required_argument, NULL, OPT_PRUNE_CACHE},
+	{"dram", required_argument, NULL, OPT_DRAM},
+	{"dram-policy", required_argument, NULL, OPT_DRAM_POLICY},
+	{"dram-map", required_argument, NULL, OPT_DRAM_MAP},
+	{"sectors", required_argument, NULL, OPT_SECTORS},
+	{"page-map", required_argument, NULL, OPT_PAGE_MAP},
+	{"page-seed", required_argument, NULL, OPT_PAGE_SEED},
+	{NULL, 0, NULL, 0}
+};
+
+// parses a "<s>,<E>,<b>" cache geometry
+int parse_geometry(char *str, int *s, int *E, int *b)
+{
+	char extra;
+	if (sscanf(str, "%d,%d,%d%c", s, E, b, &extra) != 3)
+		return -1;
+	if (*s < 0 || *E < 1 || *b < 0)
+		return -1;
+	return 0;
+}
+
+// parses a "<entries>,<ways>" TLB shape
+int parse_tlb_shape(char *str, int *entries, int *ways)
+{
+	char extra;
+	if (sscanf(str, "%d,%d%c", entries, ways, &extra) != 2)
+		return -1;
+	if (*entries < 1 || *ways < 1 || *entries % *ways != 0)
+		return -1;
+	return 0;
+}
+
+// page sizes supported by x86-64 paging: 4k, 2m or 1g
+int parse_page_bits(char *str)
+{
+	if (strcmp(str, "4k") == 0 || strcmp(str, "4K") == 0)
+		return 12;
+	if (strcmp(str, "2m") == 0 || strcmp(str, "2M") == 0)
+		return 21;
+	if (strcmp(str, "1g") == 0 || strcmp(str, "1G") == 0)
+		return 30;
+	return -1;
+}
+
+// parses a comma-separated list of hex way masks, one per trace
+int parse_way_masks(char *str, unsigned int *masks)
+{
+	for (int t = 0; t < MAX_TRACES; ++t) {
+		char *end;
+		errno = 0;
+		unsigned long mask = strtoul(str, &end, 16);
+		if (end == str || errno != 0 || mask == 0 || mask > UINT_MAX)
+			return -1;
+		masks[t] = (unsigned int) mask;
+		if (*end == '\0')
+			return 0;
+		if (*end != ',')
+			return -1;
+		str = end + 1;
+	}
+	return -1;
+}
+
 int parse_input(Input *input, int argc, char *argv[])
 {
 	opterr = 0;
-	char opt;
-	while ((opt = getopt(argc, argv, "+vs:E:b:t:")) != -1)
+	int opt;
+	while ((opt = getopt_long(argc, argv, "+vs:E:b:t:", long_options, NULL)) != -1)
 		switch (opt) {
 		case 'v':
 			VERBOSE = 1;
@@ -83,216 +228,1176 @@ int parse_input(Input *input, int argc, char *argv[])
 				return -1;
 			break;
 		case 't':
-			input->trace_file_path = optarg;
+			if (input->ntraces == MAX_TRACES)
+				return -1;
+			input->trace_file_paths[input->ntraces++] = optarg;
+			input->trace_file_path = input->trace_file_paths[0];
+			break;
+		case OPT_HEATMAP:
+			if ((input->heat_top = parse_int(optarg)) < 1)
+				return -1;
+			break;
+		case OPT_REGION_BITS:
+			if ((input->region_bits = parse_int(optarg)) < 0 || input->region_bits > 63)
+				return -1;
+			break;
+		case OPT_REGION_MAP:
+			input->region_map_path = optarg;
+			break;
+		case OPT_DIFF:
+			if (parse_geometry(optarg, &input->diff_s, &input->diff_E, &input->diff_b) == -1)
+				return -1;
+			input->diff = 1;
+			break;
+		case OPT_SPLIT:
+			input->split = 1;
+			break;
+		case OPT_ICACHE:
+			if (parse_geometry(optarg, &input->icache_s, &input->icache_E, &input->icache_b) == -1)
+				return -1;
+			input->icache = 1;
+			break;
+		case OPT_UNIFIED:
+			input->unified = 1;
+			break;
+		case OPT_TLB:
+			if (parse_tlb_shape(optarg, &input->tlb_entries, &input->tlb_ways) == -1)
+				return -1;
+			break;
+		case OPT_STLB:
+			if (parse_tlb_shape(optarg, &input->stlb_entries, &input->stlb_ways) == -1)
+				return -1;
+			break;
+		case OPT_PAGE_SIZE:
+			if ((input->page_bits = parse_page_bits(optarg)) == -1)
+				return -1;
+			break;
+		case OPT_MESI:
+			if (parse_geometry(optarg, &input->llc_s, &input->llc_E, &input->llc_b) == -1)
+				return -1;
+			input->mesi = 1;
+			break;
+		case OPT_TIMESTAMPS:
+			input->timestamps = 1;
+			break;
+		case OPT_CORUN:
+			input->corun = 1;
+			break;
+		case OPT_WAYS:
+			if (parse_way_masks(optarg, input->way_masks) == -1)
+				return -1;
+			break;
+		case OPT_INDEX:
+			input->index_spec = optarg;
+			break;
+		case OPT_SETS:
+			if ((input->sets = parse_int(optarg)) < 1)
+				return -1;
+			break;
+		case OPT_L2:
+			if (parse_geometry(optarg, &input->l2_s, &input->l2_E, &input->l2_b) == -1)
+				return -1;
+			input->l2 = 1;
+			break;
+		case OPT_TIMING:
+			// same shape as a geometry: three comma-separated integers
+			if (parse_geometry(optarg, &input->l1_latency, &input->l2_latency, &input->mem_latency) == -1)
+				return -1;
+			input->timing = 1;
+			break;
+		case OPT_MSHRS:
+			if ((input->mshrs = parse_int(optarg)) < 1)
+				return -1;
+			break;
+		case OPT_ISSUE:
+			if ((input->issue_width = parse_int(optarg)) < 1)
+				return -1;
+			break;
+		case OPT_VICTIM:
+		case OPT_MISS_CACHE:
+			if ((input->victim_entries = parse_int(optarg)) < 1)
+				return -1;
+			input->miss_cache = opt == OPT_MISS_CACHE;
+			break;
+		case OPT_FAST_FORWARD:
+			input->fast_forward = 1;
+			break;
+		case OPT_RESULT_CACHE:
+			input->result_cache = optarg;
+			break;
+		case OPT_PRUNE_CACHE:
+			input->prune_cache = optarg;
+			break;
+		case OPT_DRAM:
+			if (parse_geometry(optarg, &input->dram_channels, &input->dram_banks,
+			                   &input->dram_row_bytes) == -1 ||
+			    input->dram_channels < 1 || input->dram_banks < 1)
+				return -1;
+			break;
+		case OPT_DRAM_POLICY:
+			if (strcmp(optarg, "open") == 0)
+				input->dram_policy = DRAM_OPEN;
+			else if (strcmp(optarg, "closed") == 0)
+				input->dram_policy = DRAM_CLOSED;
+			else
+				return -1;
+			break;
+		case OPT_DRAM_MAP:
+			if (strcmp(optarg, "row") == 0)
+				input->dram_map = DRAM_MAP_ROW;
+			else if (strcmp(optarg, "line") == 0)
+				input->dram_map = DRAM_MAP_LINE;
+			else if (strcmp(optarg, "xor") == 0)
+				input->dram_map = DRAM_MAP_XOR;
+			else
+				return -1;
+			break;
+		case OPT_SECTORS:
+			// per-sector bits are kept in an unsigned int
+			if (log2_exact(input->sectors = parse_int(optarg)) < 1 || input->sectors > 32)
+				return -1;
+			break;
+		case OPT_PAGE_MAP:
+			if (strcmp(optarg, "identity") == 0)
+				input->page_policy = PAGE_IDENTITY;
+			else if (strcmp(optarg, "random") == 0)
+				input->page_policy = PAGE_RANDOM;
+			else if (strcmp(optarg, "color") == 0)
+				input->page_policy = PAGE_COLOR;
+			else
+				return -1;
+			input->page_map = 1;
+			break;
+		case OPT_PAGE_SEED:
+			if ((input->page_seed = parse_int(optarg)) < 0)
+				return -1;
 			break;
 		default:
 			return -1;
 		}
+	// way masks apply to co-run traces, and have a bit per way of at most 32
+	if (input->way_masks[0] && !input->corun)
+		return -1;
+	if (input->corun && input->E > 32)
+		return -1;
+	// only --mesi and --corun run more than one trace, and they model
+	// different machines: coherent private caches, or one shared cache
+	if (input->ntraces > 1 && !input->mesi && !input->corun)
+		return -1;
+	if (input->mesi && input->corun)
+		return -1;
+	// the identity-mapped rerun of --page-map rebuilds only L1, sectors and L2,
+	// so the two runs would model different machines with any of these
+	if (input->page_map && (input->victim_entries || input->timing || input->dram_channels))
+		return -1;
+	// --diff compares two plain caches: it models none of these, and indexes
+	// both by the low bits, as only s, E and b are given for the second
+	if (input->diff && (input->l2 || input->victim_entries || input->timing ||
+	                    input->dram_channels || input->sectors || input->page_map ||
+	                    input->icache || input->unified || input->index_spec || input->sets))
+		return -1;
 	return 0;
 }
 
-int pow2(int i)
+// applies --index and --sets on top of the plain s/E/b geometry
+int configure_index(Config *config, Input *input)
+{
+	const char *spec = input->index_spec;
+	if (spec == NULL) {
+		if (input->sets)
+			return configure_sets(config, input->sets);
+		return 0;
+	}
+	if (strcmp(spec, "xor") == 0) {
+		if (input->sets && (config->s = log2_exact(input->sets)) == -1)
+			return -1;
+		config->S = 1 << config->s;
+		config->index_fn = INDEX_XOR;
+		return 0;
+	}
+	if (strcmp(spec, "prime") == 0) {
+		// without --sets, use the largest prime that fits in 2^s sets
+		config->S = input->sets ? input->sets : config->S;
+		while (!input->sets && config->S > 2 && !is_prime(config->S))
+			config->S--;
+		config->index_fn = INDEX_MOD;
+		return 0;
+	}
+	if (strncmp(spec, "matrix:", 7) == 0 && !input->sets) {
+		config->index_fn = INDEX_MATRIX;
+		return load_index_matrix(config, spec + 7);
+	}
+	return -1;
+}
+
+// the result cache key of a run whose only output is the summary, or -1 if
+// the run reports more than that or depends on files besides the trace
+int result_key(Input *input, char *key, size_t len)
 {
-	if (i > 30)
+	if (VERBOSE || input->heat_top || input->diff || input->icache || input->unified ||
+	    input->tlb_entries || input->l2 || input->timing || input->victim_entries ||
+	    input->dram_channels || input->sectors || input->page_map ||
+	    (input->index_spec && strncmp(input->index_spec, "matrix:", 7) == 0))
 		return -1;
-	return 1<<i;
+	int n = snprintf(key, len, "s=%d E=%d b=%d", input->s, input->E, input->b);
+	if (input->sets)
+		n += snprintf(key + n, len - n, " sets=%d", input->sets);
+	if (input->index_spec)
+		n += snprintf(key + n, len - n, " index=%s", input->index_spec);
+	if (input->split)
+		snprintf(key + n, len - n, " split");
+	return 0;
+}
+
+typedef struct {
+	unsigned long long key;
+	unsigned long long misses;
+} HeatEntry;
+
+// hottest first, ties broken by key so the output is stable
+int compare_heat(const void *a, const void *b)
+{
+	const HeatEntry *ha = a, *hb = b;
+	if (ha->misses != hb->misses)
+		return (ha->misses < hb->misses) - (ha->misses > hb->misses);
+	return (ha->key > hb->key) - (ha->key < hb->key);
+}
+
+void print_region(Heatmap *heat, unsigned long long key)
+{
+	if (heat->regions != NULL)
+		printf("%s [%llx-%llx)", heat->regions[key].name,
+		       heat->regions[key].start, heat->regions[key].end);
+	else
+		printf("page %llx", key << heat->region_bits);
 }
 
-int build_config(Config *config, Input *input)
+// fills entries (if not NULL) with the pages that missed; returns how many
+size_t page_entries(Heatmap *heat, HeatEntry *entries)
 {
-	config->s = input->s;
-	config->E = input->E;
-	config->b = input->b;
-	if ((config->S = pow2(input->s)) == -1)
+	size_t n = 0;
+	for (size_t c = 0; c < heat->nchunks; ++c) {
+		unsigned long long *chunk = heat->page_chunks[c];
+		if (chunk == NULL)
+			continue;
+		for (int i = 0; i < 1 << PAGE_CHUNK_BITS; ++i) {
+			if (!chunk[i])
+				continue;
+			if (entries != NULL) {
+				entries[n].key = heat->min_page + ((unsigned long long) c << PAGE_CHUNK_BITS) + i;
+				entries[n].misses = chunk[i];
+			}
+			++n;
+		}
+	}
+	return n;
+}
+
+int print_heatmap(Heatmap *heat, int top)
+{
+	unsigned long long total = 0;
+	for (int i = 0; i < heat->S; ++i)
+		total += heat->set_misses[i];
+	double pct = total ? 100.0 / total : 0.0;
+
+	size_t n = heat->S;
+	if (heat->regions != NULL && (size_t) heat->nregions > n)
+		n = heat->nregions;
+	else if (heat->regions == NULL && page_entries(heat, NULL) > n)
+		n = page_entries(heat, NULL);
+	HeatEntry *entries;
+	if ((entries = (HeatEntry *) malloc(n * sizeof(HeatEntry))) == NULL)
 		return -1;
+
+	for (int i = 0; i < heat->S; ++i) {
+		entries[i].key = i;
+		entries[i].misses = heat->set_misses[i];
+	}
+	qsort(entries, heat->S, sizeof(HeatEntry), compare_heat);
+	printf("hottest sets:\n");
+	for (int i = 0; i < top && i < heat->S && entries[i].misses; ++i)
+		printf("  set %llu: %llu misses (%.1f%%)\n",
+		       entries[i].key, entries[i].misses, entries[i].misses * pct);
+
+	size_t nregions = 0;
+	if (heat->regions != NULL) {
+		for (int i = 0; i < heat->nregions; ++i) {
+			entries[nregions].key = i;
+			entries[nregions++].misses = heat->region_misses[i];
+		}
+	} else {
+		nregions = page_entries(heat, entries);
+	}
+	qsort(entries, nregions, sizeof(HeatEntry), compare_heat);
+	printf("hottest regions:\n");
+	for (size_t i = 0; i < (size_t) top && i < nregions && entries[i].misses; ++i) {
+		printf("  ");
+		print_region(heat, entries[i].key);
+		printf(": %llu misses (%.1f%%)\n", entries[i].misses, entries[i].misses * pct);
+	}
+	if (heat->unmapped)
+		printf("  unmapped: %llu misses (%.1f%%)\n", heat->unmapped, heat->unmapped * pct);
+
+	printf("set histogram:\n");
+	for (int i = 0; i < heat->S; ++i)
+		printf("  %d %llu\n", i, heat->set_misses[i]);
+	printf("region histogram:\n");
+	for (size_t i = 0; i < nregions; ++i) {
+		if (!entries[i].misses)
+			continue;
+		printf("  ");
+		print_region(heat, entries[i].key);
+		printf(" %llu\n", entries[i].misses);
+	}
+
+	free(entries);
 	return 0;
 }
 
-int init_lru_queue(Set *set, int E)
+void print_victim(Victim *victim, int entries)
+{
+	printf("%s (%d entries): probes:%llu hits:%llu (misses absorbed) fills:%llu\n",
+	       victim->miss_cache ? "miss cache" : "victim cache", entries,
+	       victim->probes, victim->hits, victim->fills.misses);
+}
+
+void print_tlb(Tlb *tlb, Input *input)
+{
+	printf("TLB (%d entries, %d-way, %d-byte pages): hits:%llu misses:%llu\n",
+	       input->tlb_entries, input->tlb_ways, 1 << input->page_bits,
+	       tlb->l1_result.hits, tlb->l1_result.misses);
+	if (tlb->has_l2)
+		printf("STLB (%d entries, %d-way): hits:%llu misses:%llu\n",
+		       input->stlb_entries, input->stlb_ways,
+		       tlb->l2_result.hits, tlb->l2_result.misses);
+	printf("page walks:%llu walk memory references:%llu\n", tlb->walks, tlb->walk_refs);
+}
+
+void print_timing(Timing *timing)
+{
+	unsigned long long cycles = timing->finish;
+	unsigned long long ideal = (timing->refs + timing->issue_width - 1) / timing->issue_width;
+	printf("timing: cycles:%llu AMAT:%.2f stall cycles:%llu (mshr full:%llu)"
+	       " MLP:%.2f merged misses:%llu\n",
+	       cycles, timing->refs ? (double) timing->latency_sum / timing->refs : 0.0,
+	       cycles > ideal ? cycles - ideal : 0, timing->mshr_stalls,
+	       timing->busy_cycles ? (double) timing->miss_cycles / timing->busy_cycles : 0.0,
+	       timing->merged);
+}
+
+void print_dram(Dram *dram)
+{
+	const char *maps[] = {"row", "line", "xor"};
+	unsigned long long accesses = dram->reads + dram->writes;
+	printf("DRAM (%d channels x %d banks, %d-byte rows, %s policy, %s interleaving):"
+	       " reads:%llu writes:%llu\n", dram->channels, dram->banks, 1 << dram->row_bits,
+	       dram->policy == DRAM_OPEN ? "open" : "closed", maps[dram->map],
+	       dram->reads, dram->writes);
+	printf("row buffer: hits:%llu empty:%llu conflicts:%llu hit rate:%.1f%%\n",
+	       dram->row_hits, dram->row_empty, dram->row_conflicts,
+	       accesses ? 100.0 * dram->row_hits / accesses : 0.0);
+	// the bank with the most conflicts, if any
+	int worst = 0;
+	for (int i = 1; i < dram->channels * dram->banks; ++i)
+		if (dram->bank_conflicts[i] > dram->bank_conflicts[worst])
+			worst = i;
+	if (dram->bank_conflicts[worst])
+		printf("most conflicted bank: channel %d bank %d (%llu conflicts)\n",
+		       worst / dram->banks, worst % dram->banks, dram->bank_conflicts[worst]);
+}
+
+void print_sectors(Sectors *sectors, int b)
 {
-	if ((set->lru_queue = (int *) malloc(E * sizeof(int))) == NULL)
+	int sector_bytes = 1 << (b - sectors->bits);
+	unsigned long long fetched = sectors->fetched * sector_bytes;
+	unsigned long long whole = sectors->line_misses << b;
+	printf("sectors (%d x %d bytes): line misses:%llu sector misses:%llu\n",
+	       1 << sectors->bits, sector_bytes, sectors->line_misses, sectors->sector_misses);
+	printf("bytes fetched:%llu (whole lines:%llu, %.1f%% saved) bytes written back:%llu\n",
+	       fetched, whole, whole ? 100.0 * (whole - fetched) / whole : 0.0,
+	       sectors->written_back * sector_bytes);
+}
+
+void print_page_map(PageMap *map)
+{
+	const char *policies[] = {"identity", "random", "color"};
+	unsigned long long least = map->color_pages[0], most = map->color_pages[0];
+	for (int i = 1; i < map->colors; ++i) {
+		if (map->color_pages[i] < least)
+			least = map->color_pages[i];
+		if (map->color_pages[i] > most)
+			most = map->color_pages[i];
+	}
+	printf("page map (%s, %d-byte pages, %d colors): pages:%llu pages per color: min:%llu max:%llu\n",
+	       policies[map->policy], 1 << map->page_bits, map->colors, map->pages, least, most);
+}
+
+// misses of a page-mapped level against the same level indexed virtually
+void print_mapped(const char *level, Result *mapped, Result *identity)
+{
+	long long change = (long long) (mapped->misses - identity->misses);
+	printf("%s mapped: misses:%llu evictions:%llu, identity: misses:%llu evictions:%llu (%+.1f%% misses)\n",
+	       level, mapped->misses, mapped->evictions, identity->misses, identity->evictions,
+	       identity->misses ? 100.0 * change / identity->misses : 0.0);
+}
+
+void print_outcome(int outcome)
+{
+	if (outcome & REF_MISS)
+		printf("miss ");
+	else
+		printf("hit ");
+	if (outcome & REF_EVICTION)
+		printf("eviction ");
+}
+
+// references --fast-forward decodes at a time
+#define FAST_CHUNK 65536
+
+// simulate() for --fast-forward: decodes FAST_CHUNK references at a time,
+// folds their strided and same-block runs, and replays those. a run cut by
+// the end of a chunk just continues in the next one
+int simulate_fast(Cache *cache, Result *result, const char *trace_file_path)
+{
+	TraceReader reader;
+	Trace chunk;
+	if (open_trace(&reader, trace_file_path) == -1)
 		return -1;
-	for (int i = 0; i < E; ++i)
-		set->lru_queue[i] = i;
+	if ((chunk.refs = (Ref *) malloc(FAST_CHUNK * sizeof(Ref))) == NULL) {
+		close_trace(&reader);
+		return -1;
+	}
+	int more = 1;
+	while (more) {
+		chunk.n = 0;
+		while (chunk.n < FAST_CHUNK && (more = read_ref(&reader, &chunk.refs[chunk.n])))
+			chunk.n++;
+		encode_strides(&chunk, !cache->write_back);
+		if (can_coalesce(cache))
+			coalesce_trace(&chunk, cache, cache->b);
+		for (size_t i = 0; i < chunk.n; ++i)
+			replay_ref(cache, &chunk.refs[i], result);
+	}
+	free(chunk.refs);
+	close_trace(&reader);
 	return 0;
 }
 
-int allocate_cache(Cache *cache, Config *config)
+int simulate(Cache *cache, Cache *icache, Result *result, Result *iresult,
+             const char *trace_file_path)
 {
-	cache->s = config->s;
-	cache->S = config->S;
-	cache->b = config->b;
-	// allocate array of sets
-	if ((cache->sets = (Set *) malloc(config->S * sizeof(Set))) == NULL)
+	TraceReader reader;
+	if (open_trace(&reader, trace_file_path) == -1)
 		return -1;
 
-	for (int i = 0; i < config->S; ++i) {
-		// allocate array of lines for each set
-		if ((cache->sets[i].lines = (Line *) malloc(config->E * sizeof(Line))) == NULL)
-			return -1;
-		cache->sets[i].E = config->E;
-		// set valid bits to 0 for each line
-		for (int j = 0; j < config->E; ++j)
-			cache->sets[i].lines[j].valid = 0;
-		if ((init_lru_queue(&cache->sets[i], config->E)) == -1)
-			return -1;
+	Ref ref;
+	// runs of data references to one block are folded into run
+	int coalesce = !VERBOSE && can_coalesce(cache);
+	Ref run;
+	int pending = 0;
+	while (read_ref(&reader, &ref)) {
+		if (ref.op == 'I') {
+			if (icache == NULL)
+				continue;
+			if (icache == cache && pending) {
+				replay_ref(cache, &run, result);
+				pending = 0;
+			}
+			int outcome = ref_span(icache, ref.address, ref.size, 0, iresult);
+			if (VERBOSE) {
+				printf("%s ", trace_line(&reader, &ref));
+				print_outcome(outcome);
+				printf("\n");
+			}
+			continue;
+		}
+		if (coalesce) {
+			if (pending && (run.address >> cache->b) == (ref.address >> cache->b) &&
+			    single_block(cache, &ref, cache->b)) {
+				fold_ref(&run, &ref);
+				continue;
+			}
+			if (pending)
+				replay_ref(cache, &run, result);
+			run = ref;
+			run.repeat = 0;
+			pending = single_block(cache, &run, cache->b);
+			if (!pending)
+				replay_ref(cache, &run, result);
+			continue;
+		}
+		if (VERBOSE)
+			printf("%s ", &trace_line(&reader, &ref)[1]);
+		int outcome = ref_span(cache, ref.address, ref.size, ref.op == 'S', result);
+		if (VERBOSE)
+			print_outcome(outcome);
+		if (ref.op == 'M') {
+			outcome = ref_span(cache, ref.address, ref.size, 1, result);
+			if (VERBOSE)
+				print_outcome(outcome);
+		}
+		if (VERBOSE)
+			printf("\n");
 	}
+	if (pending)
+		replay_ref(cache, &run, result);
+	close_trace(&reader);
+	return 0;
+}
+
+// where two cache models disagree on a reference
+typedef struct {
+	unsigned long long hit_to_miss;  // hit in the first model, miss in the second
+	unsigned long long miss_to_hit;
+} Disagreement;
+
+typedef struct {
+	Result a;
+	Result b;
+	unsigned long long both_hit;
+	unsigned long long both_miss;
+	unsigned long long hit_to_miss;
+	unsigned long long miss_to_hit;
+	AddrMap addresses;          // address -> Disagreement
+	unsigned long long *sets_a; // disagreements per set of the first model
+	unsigned long long *sets_b;
+} Diff;
 
+int init_diff(Diff *diff, Config *config_a, Config *config_b)
+{
+	memset(diff, 0, sizeof(Diff));
+	if (init_addr_map(&diff->addresses, sizeof(Disagreement)) == -1)
+		return -1;
+	diff->sets_a = (unsigned long long *) calloc(config_a->S, sizeof(unsigned long long));
+	diff->sets_b = (unsigned long long *) calloc(config_b->S, sizeof(unsigned long long));
+	if (diff->sets_a == NULL || diff->sets_b == NULL)
+		return -1;
 	return 0;
 }
 
-void deallocate_cache(Cache *cache)
+void free_diff(Diff *diff)
 {
-	for (int i = 0; i < cache->S; ++i) {
-		free(cache->sets[i].lines);
-		free(cache->sets[i].lru_queue);
+	free_addr_map(&diff->addresses);
+	free(diff->sets_a);
+	free(diff->sets_b);
+}
+
+void diff_ref(Cache *a, Cache *b, Ref *ref, int store, Diff *diff)
+{
+	unsigned long long address = ref->address;
+	int miss_a = ref_span(a, address, ref->size, store, &diff->a) & REF_MISS;
+	int miss_b = ref_span(b, address, ref->size, store, &diff->b) & REF_MISS;
+	if (miss_a == miss_b) {
+		if (miss_a)
+			diff->both_miss++;
+		else
+			diff->both_hit++;
+		return;
 	}
-	free(cache->sets);
+	Disagreement *d = addr_map_get(&diff->addresses, address, 1);
+	if (miss_b) {
+		diff->hit_to_miss++;
+		if (d != NULL)
+			d->hit_to_miss++;
+	} else {
+		diff->miss_to_hit++;
+		if (d != NULL)
+			d->miss_to_hit++;
+	}
+	unsigned long long tag;
+	diff->sets_a[set_of(a, address >> a->b, &tag)]++;
+	diff->sets_b[set_of(b, address >> b->b, &tag)]++;
 }
 
-int index_of(int *lru_queue, int line)
+// replays one decoded trace through both caches in lockstep
+void diff_one(Cache *a, Cache *b, Ref *ref, Diff *diff)
 {
-	int i = 0;
-	while (*lru_queue != line) {
-		lru_queue++;
-		++i;
+	diff_ref(a, b, ref, ref->op == 'S', diff);
+	if (ref->op == 'M')
+		diff_ref(a, b, ref, 1, diff);
+	diff->a.hits += ref->repeat;
+	diff->b.hits += ref->repeat;
+	diff->both_hit += ref->repeat;
+	if (a->tlb)
+		a->tlb->l1_result.hits += ref->repeat;
+}
+
+void simulate_diff(Cache *a, Cache *b, Trace *trace, Diff *diff)
+{
+	int min_b = a->b < b->b ? a->b : b->b;
+	for (size_t i = 0; i < trace->n; ++i) {
+		Ref *ref = &trace->refs[i];
+		if (ref->op == 'I')
+			continue;
+		if (ref->count > 1) {
+			// a block of the smaller geometry lies inside one block of the other
+			Ref one = *ref;
+			one.count = 1;
+			int bulk = bulk_stride(a, ref, min_b) && bulk_stride(b, ref, min_b);
+			for (int k = 0; k < ref->count; ) {
+				one.address = ref->address + (unsigned long long) k * ref->stride;
+				int len = bulk ? stride_run(ref, k, min_b) : 1;
+				one.repeat = (len - 1) * (ref->op == 'M' ? 2 : 1);
+				diff_one(a, b, &one, diff);
+				k += len;
+			}
+			continue;
+		}
+		diff_one(a, b, ref, diff);
 	}
-	return i;
 }
 
-void update_lru_queue(int *lru_queue, int line, int len)
+int print_top_sets(const char *title, unsigned long long *counts, int S, int top)
 {
-	int index = index_of(lru_queue, line);
-	if (index == (len-1))
-		return;
-	int tmp = lru_queue[len-1];
-	lru_queue[len-1] = lru_queue[index];
-	while (index < len-2) {
-		lru_queue[index] = lru_queue[index+1];
-		++index;
+	HeatEntry *entries;
+	if ((entries = (HeatEntry *) malloc(S * sizeof(HeatEntry))) == NULL)
+		return -1;
+	for (int i = 0; i < S; ++i) {
+		entries[i].key = i;
+		entries[i].misses = counts[i];
 	}
-	lru_queue[len-2] = tmp;
+	qsort(entries, S, sizeof(HeatEntry), compare_heat);
+	printf("%s:\n", title);
+	for (int i = 0; i < top && i < S && entries[i].misses; ++i)
+		printf("  set %llu: %llu\n", entries[i].key, entries[i].misses);
+	free(entries);
+	return 0;
 }
 
-void evict_lru(Set *set, unsigned long long tag)
+int print_diff(Diff *diff, Config *config_a, Config *config_b, int top)
 {
-	int line_index = set->lru_queue[0];
-	set->lines[line_index].tag = tag;
-	update_lru_queue(set->lru_queue, line_index, set->E);
+	printf("A (s=%d, E=%d, b=%d): hits:%llu misses:%llu evictions:%llu\n",
+	       config_a->s, config_a->E, config_a->b, diff->a.hits, diff->a.misses, diff->a.evictions);
+	printf("B (s=%d, E=%d, b=%d): hits:%llu misses:%llu evictions:%llu\n",
+	       config_b->s, config_b->E, config_b->b, diff->b.hits, diff->b.misses, diff->b.evictions);
+	printf("agree: both hit:%llu both miss:%llu\n", diff->both_hit, diff->both_miss);
+	printf("disagree: hit->miss:%llu miss->hit:%llu\n", diff->hit_to_miss, diff->miss_to_hit);
+
+	AddrMap *addresses = &diff->addresses;
+	HeatEntry *entries;
+	if ((entries = (HeatEntry *) malloc((addresses->n + 1) * sizeof(HeatEntry))) == NULL)
+		return -1;
+	size_t n = 0;
+	for (size_t i = 0; i < addresses->cap; ++i)
+		if (addresses->used[i]) {
+			Disagreement *d = (Disagreement *) (addresses->vals + i * addresses->val_size);
+			entries[n].key = addresses->keys[i];
+			entries[n++].misses = d->hit_to_miss + d->miss_to_hit;
+		}
+	qsort(entries, n, sizeof(HeatEntry), compare_heat);
+	printf("most affected addresses:\n");
+	for (size_t i = 0; i < (size_t) top && i < n; ++i) {
+		Disagreement *d = addr_map_get(addresses, entries[i].key, 0);
+		printf("  %llx: hit->miss:%llu miss->hit:%llu\n",
+		       entries[i].key, d->hit_to_miss, d->miss_to_hit);
+	}
+	free(entries);
+
+	if (print_top_sets("most affected sets (A)", diff->sets_a, config_a->S, top) == -1)
+		return -1;
+	return print_top_sets("most affected sets (B)", diff->sets_b, config_b->S, top);
 }
 
-int update(Set *set, unsigned long long tag)
+int load_traces(Trace *traces, Input *input)
 {
-	int added = 0;
-	for (int i = 0; i < set->E; ++i) {
-		if (set->lines[i].valid == 0) {
-			set->lines[i].valid = 1;
-			set->lines[i].tag = tag;
-			added = 1;
-			update_lru_queue(set->lru_queue, i, set->E);
-			break;
+	for (int t = 0; t < input->ntraces; ++t)
+		if (load_trace(&traces[t], input->trace_file_paths[t]) == -1)
+			return -1;
+	return 0;
+}
+
+// reruns the data cache (and L2) of input with addresses left virtual, for
+// comparison against a page-mapped run
+int run_identity(Input *input, Config *config, Result *result, Result *l2_result)
+{
+	Cache cache, l2;
+	Result iresult = {0, 0, 0};
+	Sectors sectors = {0};
+	if (allocate_cache(&cache, config) == -1)
+		return -1;
+	cache.split = input->split;
+	if (input->sectors) {
+		sectors.bits = log2_exact(input->sectors);
+		cache.sectors = &sectors;
+	}
+	if (input->l2) {
+		Config l2_config;
+		if (build_config(&l2_config, input->l2_s, input->l2_E, input->l2_b) == -1 ||
+		    allocate_cache(&l2, &l2_config) == -1) {
+			deallocate_cache(&cache);
+			return -1;
 		}
+		cache.next = &l2;
+		cache.next_result = l2_result;
 	}
-	if (!added) {
-		evict_lru(set, tag);
-		return 1;
+	int ret = simulate(&cache, input->unified ? &cache : NULL, result, &iresult,
+	                   input->trace_file_path);
+	deallocate_cache(&cache);
+	if (input->l2)
+		deallocate_cache(&l2);
+	return ret;
+}
+
+int simulate_multicore(Multicore *mc, Trace *traces, int by_time)
+{
+	size_t pos[MAX_TRACES] = {0};
+	int turn = 0;
+	int core;
+	while ((core = next_trace(traces, pos, mc->ncores, &turn, by_time)) != -1) {
+		Ref *ref = &traces[core].refs[pos[core]++];
+		if (ref->op == 'I')
+			continue;
+		if (ref->op != 'S' && coherent_ref(mc, core, ref->address, 0) == -1)
+			return -1;
+		if (ref->op != 'L' && coherent_ref(mc, core, ref->address, 1) == -1)
+			return -1;
 	}
 	return 0;
 }
 
-void ref_mem(Cache *cache, unsigned long long address, Result *result)
+int print_multicore(Multicore *mc, Input *input, int top)
 {
-	// don't need the b bits
-	address >>= cache->b;
-	int index = address & (pow2(cache->s)-1);
-	unsigned long long tag = address >> cache->s;
-	int hit = 0;
-	for (int i = 0; i < cache->sets[index].E; ++i) {
-		if (cache->sets[index].lines[i].valid &&
-                    cache->sets[index].lines[i].tag == tag) {
-			result->hits++;
-			hit = 1;
-			update_lru_queue(cache->sets[index].lru_queue, i, cache->sets[index].E);
-			if (VERBOSE)
-				printf("hit ");
-			break;
+	for (int c = 0; c < mc->ncores; ++c)
+		printf("core %d: hits:%llu misses:%llu evictions:%llu sharing misses:%llu\n", c,
+		       mc->l1_result[c].hits, mc->l1_result[c].misses, mc->l1_result[c].evictions,
+		       mc->sharing_misses[c]);
+	printf("LLC (s=%d, E=%d, b=%d): hits:%llu misses:%llu evictions:%llu\n",
+	       input->llc_s, input->llc_E, input->llc_b,
+	       mc->llc_result.hits, mc->llc_result.misses, mc->llc_result.evictions);
+	printf("coherence: invalidations:%llu upgrades:%llu interventions:%llu writebacks:%llu\n",
+	       mc->invalidations, mc->upgrades, mc->interventions, mc->writebacks);
+
+	AddrMap *directory = &mc->directory;
+	HeatEntry *entries;
+	if ((entries = (HeatEntry *) malloc((directory->n + 1) * sizeof(HeatEntry))) == NULL)
+		return -1;
+	size_t n = 0;
+	for (size_t i = 0; i < directory->cap; ++i) {
+		if (!directory->used[i])
+			continue;
+		DirEntry *dir = (DirEntry *) (directory->vals + i * directory->val_size);
+		if (dir->false_sharing) {
+			entries[n].key = directory->keys[i];
+			entries[n++].misses = dir->false_sharing;
 		}
 	}
-	if (!hit) {
-		result->misses++;
-		if (VERBOSE)
-			printf("miss ");
-		int e = update(&cache->sets[index], tag);
-		result->evictions += e;
-		if (VERBOSE && e)
-			printf("eviction ");
+	qsort(entries, n, sizeof(HeatEntry), compare_heat);
+	printf("false sharing candidates: %zu lines\n", n);
+	for (size_t i = 0; i < (size_t) top && i < n; ++i) {
+		DirEntry *dir = addr_map_get(directory, entries[i].key, 0);
+		printf("  line %llx: writers:%#x conflicting writes:%llu invalidations:%llu\n",
+		       entries[i].key << input->b, dir->writers, dir->false_sharing, dir->invalidations);
 	}
+	free(entries);
+	return 0;
 }
 
-int simulate(Cache *cache, Result *result, const char *trace_file_path)
+// replays every -t trace as one core; returns -1 on failure
+int run_multicore(Input *input, Config *config)
 {
-	FILE *trace_file;
-	if ((trace_file = fopen(trace_file_path, "r")) == NULL)
+	Multicore mc;
+	Config llc_config;
+	Trace traces[MAX_TRACES];
+	memset(&mc, 0, sizeof(Multicore));
+	mc.ncores = input->ntraces;
+	if (build_config(&llc_config, input->llc_s, input->llc_E, input->llc_b) == -1)
+		return -1;
+	for (int c = 0; c < mc.ncores; ++c)
+		if (allocate_cache(&mc.l1[c], config) == -1)
+			return -1;
+	if (allocate_cache(&mc.llc, &llc_config) == -1 ||
+	    init_addr_map(&mc.directory, sizeof(DirEntry)) == -1)
+		return -1;
+	if (load_traces(traces, input) == -1)
+		return -1;
+	if (simulate_multicore(&mc, traces, input->timestamps) == -1)
 		return -1;
+	free_traces(traces, mc.ncores);
 
-	// parsing the Valgrind memory trace (csapp.cs.cmu.edu/3e/cachelab.pdf page 2)
-	const int STR_SIZE = 32;
-	char line_str[STR_SIZE];
-	while (fgets(line_str, STR_SIZE, trace_file) != NULL) {
-		// can ignore instruction operations
-		if (line_str[0] == 'I')
-			continue;
-		if (VERBOSE) {
-			char *newline = strstr(line_str, "\n");
-			*newline = '\0';
-			printf("%s ", &line_str[1]);
-		}
-		char *end;
-		unsigned long long address = strtoull(&line_str[3], &end, 16);
-		if (line_str[1] == 'M') {
-			ref_mem(cache, address, result);
-			ref_mem(cache, address, result);
-		} else
-			ref_mem(cache, address, result);
-		if (VERBOSE)
-			printf("\n");
+	Result total = {0, 0, 0};
+	for (int c = 0; c < mc.ncores; ++c) {
+		total.hits += mc.l1_result[c].hits;
+		total.misses += mc.l1_result[c].misses;
+		total.evictions += mc.l1_result[c].evictions;
+		deallocate_cache(&mc.l1[c]);
+	}
+	deallocate_cache(&mc.llc);
+	printSummary(total.hits, total.misses, total.evictions);
+	int status = print_multicore(&mc, input, input->heat_top ? input->heat_top : 10);
+	free_addr_map(&mc.directory);
+	return status;
+}
+
+// runs every -t trace alone and then interleaved into one shared cache, each
+// trace filling only the ways in its mask; returns -1 on failure
+int run_corun(Input *input, Config *config)
+{
+	Trace traces[MAX_TRACES];
+	Result alone[MAX_TRACES];
+	Result shared[MAX_TRACES];
+	int n = input->ntraces;
+	Cache cache;
+
+	for (int t = 0; t < n; ++t)
+		if (input->way_masks[t] && !(input->way_masks[t] & ((1ULL << config->E) - 1)))
+			return -1;
+	if (load_traces(traces, input) == -1)
+		return -1;
+
+	for (int t = 0; t < n; ++t) {
+		if (allocate_cache(&cache, config) == -1)
+			return -1;
+		cache.split = input->split;
+		cache.way_mask = input->way_masks[t];
+		memset(&alone[t], 0, sizeof(Result));
+		for (size_t i = 0; i < traces[t].n; ++i)
+			replay_ref(&cache, &traces[t].refs[i], &alone[t]);
+		deallocate_cache(&cache);
+	}
+
+	if (allocate_cache(&cache, config) == -1)
+		return -1;
+	cache.split = input->split;
+	memset(shared, 0, sizeof(shared));
+	size_t pos[MAX_TRACES] = {0};
+	int turn = 0;
+	int t;
+	while ((t = next_trace(traces, pos, n, &turn, input->timestamps)) != -1) {
+		cache.way_mask = input->way_masks[t];
+		replay_ref(&cache, &traces[t].refs[pos[t]++], &shared[t]);
+	}
+	deallocate_cache(&cache);
+	free_traces(traces, n);
+
+	Result total = {0, 0, 0};
+	for (t = 0; t < n; ++t) {
+		total.hits += shared[t].hits;
+		total.misses += shared[t].misses;
+		total.evictions += shared[t].evictions;
+	}
+	printSummary(total.hits, total.misses, total.evictions);
+	for (t = 0; t < n; ++t) {
+		printf("trace %d (%s, ways %#x):\n", t, input->trace_file_paths[t],
+		       input->way_masks[t] ? input->way_masks[t] : (unsigned int) ((1ULL << config->E) - 1));
+		printf("  alone:  hits:%llu misses:%llu evictions:%llu\n",
+		       alone[t].hits, alone[t].misses, alone[t].evictions);
+		printf("  co-run: hits:%llu misses:%llu evictions:%llu (%+lld misses)\n",
+		       shared[t].hits, shared[t].misses, shared[t].evictions,
+		       (long long) (shared[t].misses - alone[t].misses));
 	}
-	fclose(trace_file);
 	return 0;
 }
 
 int main(int argc, char *argv[])
 {
 	// user supplies 3 cache parameters and a memory trace file
-	Input input;
+	Input input = {0};
+	input.region_bits = 12;
+	input.page_bits = 12;
+	input.mshrs = 10;
+	input.issue_width = 1;
 	if ((parse_input(&input, argc, argv)) == -1) {
-		fprintf(stderr, "usage: %s -s <num> -E <num> -b <num> -t <file>\n", argv[0]);
+		fprintf(stderr, "usage: %s -s <num> -E <num> -b <num> -t <file>"
+		        " [--heatmap <top> [--region-bits <num> | --region-map <file>]]"
+		        " [--diff <s>,<E>,<b>] [--split] [--icache <s>,<E>,<b> | --unified]"
+		        " [--tlb <entries>,<ways> [--stlb <entries>,<ways>] [--page-size 4k|2m|1g]]"
+		        " [--mesi <s>,<E>,<b> | --corun [--ways <mask>,...]] [--timestamps] [-t <file>...]"
+		        " [--index xor|prime|matrix:<file>] [--sets <num>] [--l2 <s>,<E>,<b>]"
+		        " [--timing <l1>,<l2>,<mem> [--mshrs <num>] [--issue <num>]]"
+		        " [--victim <entries> | --miss-cache <entries>] [--fast-forward]"
+		        " [--result-cache <dir>] [--prune-cache <dir>]"
+		        " [--dram <channels>,<banks>,<row bytes> [--dram-policy open|closed]"
+		        " [--dram-map row|line|xor]] [--sectors <num>]"
+		        " [--page-map identity|random|color [--page-seed <num>]]\n",
+		        argv[0]);
 		exit(EXIT_FAILURE);
 	}
 
+	if (input.prune_cache) {
+		int removed = csim_cache_prune(input.prune_cache);
+		if (removed == -1) {
+			fprintf(stderr, "%s: error: cannot prune result cache %s.\n", argv[0],
+			        input.prune_cache);
+			exit(EXIT_FAILURE);
+		}
+		printf("pruned %d stale results from %s\n", removed, input.prune_cache);
+		return 0;
+	}
+
 	// build the Config object with s, E, and b values from user input
 	// then derive S value
 	Config config;
-	if ((build_config(&config, &input)) == -1) {
+	if ((build_config(&config, input.s, input.E, input.b)) == -1 ||
+	    configure_index(&config, &input) == -1) {
 		fprintf(stderr, "%s: error: input parameters are invalid.\n", argv[0]);
 		exit(EXIT_FAILURE);
 	}
 
+	if (input.mesi) {
+		if (run_multicore(&input, &config) == -1) {
+			fprintf(stderr, "%s: error: multicore simulation failed.\n", argv[0]);
+			exit(EXIT_FAILURE);
+		}
+		return 0;
+	}
+	if (input.corun) {
+		if (run_corun(&input, &config) == -1) {
+			fprintf(stderr, "%s: error: co-run simulation failed.\n", argv[0]);
+			exit(EXIT_FAILURE);
+		}
+		return 0;
+	}
+
+	// a summary-only run may already have been simulated on this trace
+	char key[128];
+	csim_stats_t stats;
+	int cacheable = input.result_cache && result_key(&input, key, sizeof(key)) == 0;
+	if (cacheable &&
+	    csim_cache_lookup(input.result_cache, input.trace_file_path, key, &stats) == 1) {
+		printSummary(stats.hits, stats.misses, stats.evictions);
+		return 0;
+	}
+
 	// Cache = array of Set; Set = array of Line; Line = struct {int,int}
 	Cache cache;
 	if (allocate_cache(&cache, &config) == -1) {
 		fprintf(stderr, "%s: error: failed to allocate cache structure.\n", argv[0]);
 		exit(EXIT_FAILURE);
 	}
+	cache.split = input.split;
+
+	// optional address translation on the data stream
+	Tlb tlb;
+	if (input.tlb_entries) {
+		if (allocate_tlb(&tlb, input.tlb_entries, input.tlb_ways,
+		                 input.stlb_entries, input.stlb_ways, input.page_bits) == -1) {
+			fprintf(stderr, "%s: error: invalid TLB configuration.\n", argv[0]);
+			exit(EXIT_FAILURE);
+		}
+		cache.tlb = &tlb;
+	}
+
+	// optional per-set / per-region miss attribution
+	Heatmap heat;
+	if (input.heat_top) {
+		if (init_heatmap(&heat, config.S, input.region_bits, input.region_map_path) == -1) {
+			fprintf(stderr, "%s: error: failed to set up miss heatmap.\n", argv[0]);
+			exit(EXIT_FAILURE);
+		}
+		cache.heat = &heat;
+	}
+
+	if (input.diff) {
+		// lockstep comparison against a second geometry over one decoded trace
+		Config diff_config;
+		Cache diff_cache;
+		Trace trace;
+		Diff diff;
+		if (build_config(&diff_config, input.diff_s, input.diff_E, input.diff_b) == -1) {
+			fprintf(stderr, "%s: error: input parameters are invalid.\n", argv[0]);
+			exit(EXIT_FAILURE);
+		}
+		if (allocate_cache(&diff_cache, &diff_config) == -1 ||
+		    init_diff(&diff, &config, &diff_config) == -1) {
+			fprintf(stderr, "%s: error: failed to allocate cache structure.\n", argv[0]);
+			exit(EXIT_FAILURE);
+		}
+		diff_cache.split = input.split;
+		if (load_trace(&trace, input.trace_file_path) == -1) {
+			fprintf(stderr, "%s: error: cache simulation failed.\n", argv[0]);
+			exit(EXIT_FAILURE);
+		}
+		if (input.fast_forward)
+			encode_strides(&trace, !cache.write_back && !diff_cache.write_back);
+		// a block of the smaller geometry lies inside one block of the other
+		if (can_coalesce(&cache))
+			coalesce_trace(&trace, &cache, config.b < diff_config.b ? config.b : diff_config.b);
+		simulate_diff(&cache, &diff_cache, &trace, &diff);
+		free(trace.refs);
+		deallocate_cache(&diff_cache);
+		deallocate_cache(&cache);
+
+		printSummary(diff.a.hits, diff.a.misses, diff.a.evictions);
+		if (print_diff(&diff, &config, &diff_config, input.heat_top ? input.heat_top : 10) == -1) {
+			fprintf(stderr, "%s: error: failed to report differences.\n", argv[0]);
+			exit(EXIT_FAILURE);
+		}
+		free_diff(&diff);
+		if (input.tlb_entries) {
+			print_tlb(&tlb, &input);
+			deallocate_tlb(&tlb);
+		}
+		if (input.heat_top) {
+			print_heatmap(&heat, input.heat_top);
+			free_heatmap(&heat);
+		}
+		return 0;
+	}
+
+	// optional instruction stream: a separate L1I, or the data cache itself
+	Cache l1i;
+	Cache *icache = NULL;
+	if (input.icache) {
+		Config icache_config;
+		if (build_config(&icache_config, input.icache_s, input.icache_E, input.icache_b) == -1) {
+			fprintf(stderr, "%s: error: input parameters are invalid.\n", argv[0]);
+			exit(EXIT_FAILURE);
+		}
+		if (allocate_cache(&l1i, &icache_config) == -1) {
+			fprintf(stderr, "%s: error: failed to allocate cache structure.\n", argv[0]);
+			exit(EXIT_FAILURE);
+		}
+		l1i.split = input.split;
+		icache = &l1i;
+	} else if (input.unified)
+		icache = &cache;
+
+	// optional second level and timing model behind the data cache
+	Cache l2;
+	Result l2_result = {0, 0, 0};
+	if (input.l2) {
+		Config l2_config;
+		if (build_config(&l2_config, input.l2_s, input.l2_E, input.l2_b) == -1) {
+			fprintf(stderr, "%s: error: input parameters are invalid.\n", argv[0]);
+			exit(EXIT_FAILURE);
+		}
+		if (allocate_cache(&l2, &l2_config) == -1) {
+			fprintf(stderr, "%s: error: failed to allocate cache structure.\n", argv[0]);
+			exit(EXIT_FAILURE);
+		}
+		cache.next = &l2;
+		cache.next_result = &l2_result;
+	}
+	Victim victim;
+	if (input.victim_entries) {
+		if (allocate_victim(&victim, input.victim_entries, config.b, input.miss_cache) == -1) {
+			fprintf(stderr, "%s: error: failed to allocate cache structure.\n", argv[0]);
+			exit(EXIT_FAILURE);
+		}
+		cache.victim = &victim;
+	}
+	Timing timing;
+	if (input.timing) {
+		if (init_timing(&timing, input.l1_latency, input.l2_latency,
+		                input.mem_latency, input.mshrs, input.issue_width) == -1) {
+			fprintf(stderr, "%s: error: failed to set up timing model.\n", argv[0]);
+			exit(EXIT_FAILURE);
+		}
+		cache.timing = &timing;
+	}
+	// misses and writebacks out of the last level go to DRAM
+	Dram dram;
+	if (input.dram_channels) {
+		Cache *last = input.l2 ? &l2 : &cache;
+		if (init_dram(&dram, input.dram_channels, input.dram_banks, input.dram_row_bytes,
+		              last->b, input.dram_policy, input.dram_map) == -1) {
+			fprintf(stderr, "%s: error: invalid DRAM configuration.\n", argv[0]);
+			exit(EXIT_FAILURE);
+		}
+		cache.write_back = 1;
+		if (input.l2)
+			l2.write_back = 1;
+		last->dram = &dram;
+	}
+	// sectored data cache; dirty sectors are tracked to count writeback bytes
+	Sectors sectors = {0};
+	if (input.sectors) {
+		if ((sectors.bits = log2_exact(input.sectors)) > config.b) {
+			fprintf(stderr, "%s: error: more sectors than bytes in a block.\n", argv[0]);
+			exit(EXIT_FAILURE);
+		}
+		cache.sectors = &sectors;
+		cache.write_back = 1;
+	}
+	// data addresses become physical before the data cache indexes them; the
+	// page colors are those of the last level
+	PageMap page_map;
+	if (input.page_map) {
+		Cache *last = input.l2 ? &l2 : &cache;
+		int color_bits = last->s + last->b - input.page_bits;
+		if (input.page_bits < config.b || (input.l2 && input.page_bits < input.l2_b) ||
+		    init_page_map(&page_map, input.page_policy, input.page_bits,
+		                  1 << (color_bits > 0 ? color_bits : 0), input.page_seed) == -1) {
+			fprintf(stderr, "%s: error: invalid page map configuration.\n", argv[0]);
+			exit(EXIT_FAILURE);
+		}
+		cache.page_map = &page_map;
+	}
 
 	Result result = {0, 0, 0};
-	if (simulate(&cache, &result, input.trace_file_path) == -1) {
+	Result iresult = {0, 0, 0};
+	if (input.fast_forward && icache == NULL && !VERBOSE) {
+		if (simulate_fast(&cache, &result, input.trace_file_path) == -1) {
+			fprintf(stderr, "%s: error: cache simulation failed.\n", argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	} else if (simulate(&cache, icache, &result, &iresult, input.trace_file_path) == -1) {
 		fprintf(stderr, "%s: error: cache simulation failed.\n", argv[0]);
 		exit(EXIT_FAILURE);
 	}
 
 	deallocate_cache(&cache);
+	if (input.icache)
+		deallocate_cache(&l1i);
 
+	if (cacheable) {
+		memset(&stats, 0, sizeof(stats));
+		stats.hits = result.hits;
+		stats.misses = result.misses;
+		stats.evictions = result.evictions;
+		if (csim_cache_store(input.result_cache, input.trace_file_path, key, &stats) == -1)
+			fprintf(stderr, "%s: warning: failed to store result in %s.\n", argv[0],
+			        input.result_cache);
+	}
 	printSummary(result.hits, result.misses, result.evictions);
+	if (icache != NULL) {
+		printf("%s I-stream: hits:%llu misses:%llu evictions:%llu\n", input.icache ? "L1I" : "unified",
+		       iresult.hits, iresult.misses, iresult.evictions);
+		printf("%s D-stream: hits:%llu misses:%llu evictions:%llu\n", input.icache ? "L1D" : "unified",
+		       result.hits, result.misses, result.evictions);
+	}
+	if (input.tlb_entries) {
+		print_tlb(&tlb, &input);
+		deallocate_tlb(&tlb);
+	}
+	if (input.heat_top) {
+		if (print_heatmap(&heat, input.heat_top) == -1) {
+			fprintf(stderr, "%s: error: failed to report miss heatmap.\n", argv[0]);
+			exit(EXIT_FAILURE);
+		}
+		free_heatmap(&heat);
+	}
+	if (input.l2) {
+		printf("L2 (s=%d, E=%d, b=%d): hits:%llu misses:%llu evictions:%llu\n",
+		       input.l2_s, input.l2_E, input.l2_b, l2_result.hits, l2_result.misses, l2_result.evictions);
+		deallocate_cache(&l2);
+	}
+	if (input.victim_entries) {
+		print_victim(&victim, input.victim_entries);
+		deallocate_cache(&victim.buf);
+	}
+	if (input.timing) {
+		print_timing(&timing);
+		free_timing(&timing);
+	}
+	if (input.dram_channels) {
+		print_dram(&dram);
+		free_dram(&dram);
+	}
+	if (input.sectors)
+		print_sectors(&sectors, config.b);
+	if (input.page_map) {
+		Result identity = {0, 0, 0};
+		Result l2_identity = {0, 0, 0};
+		if (run_identity(&input, &config, &identity, &l2_identity) == -1) {
+			fprintf(stderr, "%s: error: cache simulation failed.\n", argv[0]);
+			exit(EXIT_FAILURE);
+		}
+		print_page_map(&page_map);
+		print_mapped("L1", &result, &identity);
+		if (input.l2)
+			print_mapped("L2", &l2_result, &l2_identity);
+		free_page_map(&page_map);
+	}
 	return 0;
 }
@@ -0,0 +1,390 @@
+/*
+ * synthgen.c - Writes synthetic memory traces for scale testing csim
+ *
+ * Streams are sequential, strided, uniformly random, Zipfian, a pointer
+ * chase through a random cycle, or phases cycling through all of those,
+ * over a configurable footprint. Output is Valgrind's text format or the
+ * binary format of cachesim.h; the same seed always gives the same trace.
+ */
+#include "cachesim.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+#define OUT_BUF_SIZE (1 << 20)
+
+enum { PAT_SEQ, PAT_STRIDE, PAT_UNIFORM, PAT_ZIPF, PAT_CHASE, PAT_MIXED, NPATTERNS };
+
+const char *pattern_names[NPATTERNS] = {"seq", "stride", "uniform", "zipf", "chase", "mixed"};
+
+typedef struct {
+	int pattern;
+	unsigned long long nrefs;
+	unsigned long long footprint;  // bytes the stream ranges over
+	unsigned long long base;
+	unsigned long long stride;     // stride pattern step, and pointer-chase node size
+	int size;                      // bytes per reference
+	double store_fraction;
+	double zipf_alpha;
+	unsigned long long phase;      // references per phase of the mixed pattern
+	unsigned long long seed;
+	int binary;
+	const char *out_path;
+} Params;
+
+// splitmix64: small, fast and identical everywhere for a given seed
+typedef struct {
+	unsigned long long state;
+} Rng;
+
+unsigned long long next_rand(Rng *rng)
+{
+	unsigned long long z = (rng->state += 0x9e3779b97f4a7c15ULL);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+// uniform in [0, 1)
+double next_unit(Rng *rng)
+{
+	return (next_rand(rng) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// uniform in [0, n)
+unsigned long long next_below(Rng *rng, unsigned long long n)
+{
+	return (unsigned long long) (next_unit(rng) * n);
+}
+
+// Zipf(alpha) ranks 1..n by rejection-inversion (Hormann and Derflinger
+// 1996): constant time per sample with no table, so n can be huge
+typedef struct {
+	double alpha;
+	double n;
+	double h_x1;
+	double h_n;
+	double s;
+} Zipf;
+
+double zipf_h(Zipf *z, double x)
+{
+	double e = 1.0 - z->alpha;
+	return fabs(e) < 1e-9 ? log(x) : (pow(x, e) - 1.0) / e;
+}
+
+double zipf_h_inv(Zipf *z, double x)
+{
+	double e = 1.0 - z->alpha;
+	return fabs(e) < 1e-9 ? exp(x) : pow(x * e + 1.0, 1.0 / e);
+}
+
+void init_zipf(Zipf *z, double alpha, unsigned long long n)
+{
+	z->alpha = alpha;
+	z->n = (double) n;
+	z->h_x1 = zipf_h(z, 1.5) - 1.0;
+	z->h_n = zipf_h(z, z->n + 0.5);
+	z->s = 2.0 - zipf_h_inv(z, zipf_h(z, 2.5) - pow(2.0, -alpha));
+}
+
+unsigned long long next_zipf(Zipf *z, Rng *rng)
+{
+	for (;;) {
+		double u = z->h_n + next_unit(rng) * (z->h_x1 - z->h_n);
+		double x = zipf_h_inv(z, u);
+		double k = floor(x + 0.5);
+		if (k < 1.0)
+			k = 1.0;
+		else if (k > z->n)
+			k = z->n;
+		if (k - x <= z->s || u >= zipf_h(z, k + 0.5) - pow(k, -z->alpha))
+			return (unsigned long long) k;
+	}
+}
+
+// the state of one stream
+typedef struct {
+	Params *params;
+	Rng rng;
+	unsigned long long elements;  // footprint / size
+	unsigned long long cursor;    // seq and stride position, chase node
+	unsigned long long store_below;  // next_rand() >> 11 below this stores
+	int phase_pattern;            // mixed: pattern of the current phase...
+	unsigned long long phase_left;   // ...and its references still to come
+	Zipf zipf;
+	unsigned int *next_node;      // chase: successor of each node, one cycle
+	unsigned long long nodes;
+} Stream;
+
+// Sattolo's algorithm: a uniformly random permutation with a single cycle,
+// so the chase visits every node before repeating
+int init_chase(Stream *stream)
+{
+	stream->nodes = stream->params->footprint / stream->params->stride;
+	if (stream->nodes < 2 || stream->nodes > 0xffffffffULL)
+		return -1;
+	if ((stream->next_node = (unsigned int *) malloc(stream->nodes * sizeof(unsigned int))) == NULL)
+		return -1;
+	for (unsigned long long k = 0; k < stream->nodes; ++k)
+		stream->next_node[k] = (unsigned int) k;
+	for (unsigned long long k = stream->nodes - 1; k > 0; --k) {
+		unsigned long long j = next_below(&stream->rng, k);
+		unsigned int t = stream->next_node[k];
+		stream->next_node[k] = stream->next_node[j];
+		stream->next_node[j] = t;
+	}
+	return 0;
+}
+
+int init_stream(Stream *stream, Params *params)
+{
+	memset(stream, 0, sizeof(Stream));
+	stream->params = params;
+	stream->rng.state = params->seed;
+	stream->elements = params->footprint / params->size;
+	if (stream->elements == 0)
+		return -1;
+	// u < f exactly when u * 2^53 < ceil(f * 2^53), for the 53-bit u of
+	// next_unit(), so the op takes an integer compare and no conversion
+	stream->store_below = (unsigned long long) ceil(params->store_fraction * 9007199254740992.0);
+	stream->phase_left = params->phase;
+	init_zipf(&stream->zipf, params->zipf_alpha, stream->elements);
+	if (params->pattern == PAT_CHASE || params->pattern == PAT_MIXED)
+		return init_chase(stream);
+	return 0;
+}
+
+// the next address of pattern
+unsigned long long next_address(Stream *stream, int pattern)
+{
+	Params *params = stream->params;
+	unsigned long long offset, rank;
+	switch (pattern) {
+	case PAT_SEQ:
+		offset = (stream->cursor++ % stream->elements) * params->size;
+		break;
+	case PAT_STRIDE:
+		offset = stream->cursor % params->footprint;
+		stream->cursor = offset + params->stride;
+		break;
+	case PAT_UNIFORM:
+		offset = next_below(&stream->rng, stream->elements) * params->size;
+		break;
+	case PAT_ZIPF:
+		// scatter ranks so the hot elements are not all adjacent; 2654435761
+		// is prime, so this is a permutation unless it divides elements
+		rank = next_zipf(&stream->zipf, &stream->rng) - 1;
+		offset = (rank * 2654435761ULL % stream->elements) * params->size;
+		break;
+	default:
+		stream->cursor = stream->next_node[stream->cursor % stream->nodes];
+		offset = stream->cursor * params->stride;
+		break;
+	}
+	return params->base + offset;
+}
+
+// writes the next reference of the stream into out
+void next_ref(Stream *stream, csim_record_t *out)
+{
+	Params *params = stream->params;
+	int pattern = params->pattern;
+	if (pattern == PAT_MIXED) {
+		if (stream->phase_left == 0) {
+			stream->phase_left = params->phase;
+			if (++stream->phase_pattern == PAT_MIXED)
+				stream->phase_pattern = 0;
+		}
+		stream->phase_left--;
+		pattern = stream->phase_pattern;
+	}
+	out->address = next_address(stream, pattern);
+	out->size = params->size;
+	// a pointer chase only loads; the others store the given fraction
+	out->op = pattern != PAT_CHASE && (next_rand(&stream->rng) >> 11) < stream->store_below ? 'S' : 'L';
+}
+
+// formats " L <hex>,<size>\n" into buf; returns its length
+int format_ref(char *buf, csim_record_t *ref)
+{
+	static const char digits[] = "0123456789abcdef";
+	char digit[20];
+	int n = 0, len = 0;
+	unsigned long long address = ref->address;
+	unsigned int size = ref->size;
+	// printf is the bottleneck at these rates, so the digits are done by hand
+	do {
+		digit[n++] = digits[address & 15];
+		address >>= 4;
+	} while (address);
+	buf[len++] = ' ';
+	buf[len++] = ref->op;
+	buf[len++] = ' ';
+	while (n)
+		buf[len++] = digit[--n];
+	buf[len++] = ',';
+	do {
+		digit[n++] = digits[size % 10];
+		size /= 10;
+	} while (size);
+	while (n)
+		buf[len++] = digit[--n];
+	buf[len++] = '\n';
+	return len;
+}
+
+int generate(Params *params)
+{
+	Stream stream;
+	FILE *out = stdout;
+	char *buf;
+	size_t used = 0;
+	if (init_stream(&stream, params) == -1)
+		return -1;
+	// zeroed once: binary records are written in place and never touch pad
+	if ((buf = (char *) calloc(1, OUT_BUF_SIZE)) == NULL)
+		return -1;
+	if (params->out_path != NULL && (out = fopen(params->out_path, "wb")) == NULL) {
+		free(buf);
+		return -1;
+	}
+	if (params->binary)
+		fwrite(CSIM_TRACE_MAGIC, 1, sizeof(CSIM_TRACE_MAGIC) - 1, out);
+	for (unsigned long long i = 0; i < params->nrefs; ++i) {
+		csim_record_t ref;
+		// a text line is at most 3 + 16 + 12 bytes
+		if (used + sizeof(csim_record_t) + 32 > OUT_BUF_SIZE) {
+			fwrite(buf, 1, used, out);
+			used = 0;
+		}
+		if (params->binary) {
+			// used stays a multiple of the record size, so the slot is aligned
+			next_ref(&stream, (csim_record_t *) &buf[used]);
+			used += sizeof(csim_record_t);
+		} else {
+			next_ref(&stream, &ref);
+			used += format_ref(&buf[used], &ref);
+		}
+	}
+	fwrite(buf, 1, used, out);
+	int status = ferror(out) ? -1 : 0;
+	if (out != stdout && fclose(out) != 0)
+		status = -1;
+	free(buf);
+	free(stream.next_node);
+	return status;
+}
+
+// parses a count with an optional k, m or g (powers of 1024) suffix
+int parse_count(const char *str, unsigned long long *value)
+{
+	char *end;
+	if (*str == '-')
+		return -1;
+	*value = strtoull(str, &end, 0);
+	if (end == str)
+		return -1;
+	switch (*end) {
+	case 'k': case 'K':
+		*value <<= 10;
+		return end[1] == '\0' ? 0 : -1;
+	case 'm': case 'M':
+		*value <<= 20;
+		return end[1] == '\0' ? 0 : -1;
+	case 'g': case 'G':
+		*value <<= 30;
+		return end[1] == '\0' ? 0 : -1;
+	}
+	return *end == '\0' ? 0 : -1;
+}
+
+int parse_params(Params *params, int argc, char *argv[])
+{
+	int opt;
+	while ((opt = getopt(argc, argv, "p:n:f:a:s:e:w:z:P:S:Bo:")) != -1)
+		switch (opt) {
+		case 'p':
+			for (params->pattern = 0; params->pattern < NPATTERNS; ++params->pattern)
+				if (strcmp(optarg, pattern_names[params->pattern]) == 0)
+					break;
+			if (params->pattern == NPATTERNS)
+				return -1;
+			break;
+		case 'n':
+			if (parse_count(optarg, &params->nrefs) == -1)
+				return -1;
+			break;
+		case 'f':
+			if (parse_count(optarg, &params->footprint) == -1)
+				return -1;
+			break;
+		case 'a':
+			if (parse_count(optarg, &params->base) == -1)
+				return -1;
+			break;
+		case 's':
+			if (parse_count(optarg, &params->stride) == -1 || params->stride == 0)
+				return -1;
+			break;
+		case 'e':
+			if ((params->size = atoi(optarg)) < 1)
+				return -1;
+			break;
+		case 'w':
+			params->store_fraction = atof(optarg);
+			if (params->store_fraction < 0 || params->store_fraction > 1)
+				return -1;
+			break;
+		case 'z':
+			if ((params->zipf_alpha = atof(optarg)) <= 0)
+				return -1;
+			break;
+		case 'P':
+			if (parse_count(optarg, &params->phase) == -1 || params->phase == 0)
+				return -1;
+			break;
+		case 'S':
+			if (parse_count(optarg, &params->seed) == -1)
+				return -1;
+			break;
+		case 'B':
+			params->binary = 1;
+			break;
+		case 'o':
+			params->out_path = optarg;
+			break;
+		default:
+			return -1;
+		}
+	return optind == argc && params->footprint >= params->stride ? 0 : -1;
+}
+
+int main(int argc, char *argv[])
+{
+	Params params = {0};
+	params.pattern = PAT_SEQ;
+	params.nrefs = 1 << 20;
+	params.footprint = 1 << 24;
+	params.base = 0x10000000;
+	params.stride = 64;
+	params.size = 8;
+	params.store_fraction = 0.25;
+	params.zipf_alpha = 0.99;
+	params.phase = 1 << 20;
+	params.seed = 1;
+	if (parse_params(&params, argc, argv) == -1) {
+		fprintf(stderr, "usage: %s [-p seq|stride|uniform|zipf|chase|mixed] [-n <refs>]"
+		        " [-f <footprint bytes>] [-a <base address>] [-s <stride bytes>] [-e <ref size>]"
+		        " [-w <store fraction>] [-z <zipf alpha>] [-P <refs per phase>] [-S <seed>]"
+		        " [-B] [-o <file>]\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	if (generate(&params) == -1) {
+		fprintf(stderr, "%s: error: failed to generate trace.\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	return 0;
+}
@@ -12,6 +12,7 @@
 #include <getopt.h>
 #include <sys/types.h>
 #include "cachelab.h"
+#include "cachesim.h"
 #include <sys/wait.h> // fir WEXITSTATUS
 #include <limits.h> // for INT_MAX
 
@@ -32,6 +33,11 @@ extern int func_counter;
 /* Globals set on the command line */
 static int M = 0;
 static int N = 0;
+static char *result_cache = NULL; /* directory of stored results, or NULL */
+static int capture = 0; /* trace in-process instead of under Valgrind */
+
+/* A and B for in-process tracing, laid out back to back like tracegen's */
+static int matrices[2][MAXN][MAXN];
 
 /* The correctness and performance for the submitted transpose function */
 struct results {
@@ -41,6 +47,67 @@ struct results {
 };
 static struct results results = {-1, 0, INT_MAX};
 
+/*
+ * eval_capture - Validate function i and simulate its accesses to A and B,
+ *     recorded in-process through TRANS_LOAD() and TRANS_STORE(). Addresses
+ *     are made relative to A, so results do not depend on where the
+ *     matrices happen to be loaded. Returns -1 if the function is incorrect.
+ */
+int eval_capture(int i, csim_config_t *config, csim_stats_t *stats)
+{
+    int (*A)[MAXN] = matrices[0], (*B)[MAXN] = matrices[1];
+    int C[M][N];
+    int r, c;
+    csim_ref_t *refs;
+    size_t n, k;
+    csim_config_t split_config;
+    csim_t *sim;
+
+    printf("\nFunction %d (%d total)\nStep 1: Validating and capturing memory accesses\n",i,func_counter);
+    initMatrix(M, N, A, B);
+    startCapture();
+    (*func_list[i].func_ptr)(M, N, A, B);
+    if (stopCapture(&refs, &n) == -1) {
+        printf("Error: out of memory capturing function %d\n", i);
+        exit(1);
+    }
+
+    /* B was written with stride N, as the function saw it */
+    correctTrans(M, N, A, C);
+    for (r = 0; r < M; r++) {
+        for (c = 0; c < N; c++) {
+            if (((int (*)[N]) B)[r][c] != C[r][c]) {
+                printf("Validation error at function %d! Expected %d but got %d at B[%d][%d]\nSkipping performance evaluation for this function.\n",
+                       i, C[r][c], ((int (*)[N]) B)[r][c], r, c);
+                free(refs);
+                return -1;
+            }
+        }
+    }
+    func_list[i].correct=1;
+    if (results.funcid == i) {
+        results.correct = 1;
+    }
+    if (n == 0) {
+        printf("Warning: no accesses captured; read A and write B with TRANS_LOAD() and TRANS_STORE()\n");
+    }
+
+    printf("Step 2: Evaluating performance (s=%d, E=%d, b=%d)\n", config->s, config->E, config->b);
+    for (k = 0; k < n; k++) {
+        refs[k].address -= (unsigned long long) matrices;
+    }
+    /* Vector accesses may straddle blocks; element accesses never do */
+    split_config = *config;
+    split_config.split = 1;
+    sim = csim_create(&split_config);
+    assert(sim);
+    csim_access_batch(sim, refs, n);
+    csim_stats(sim, stats);
+    csim_destroy(sim);
+    free(refs);
+    return 0;
+}
+
 /* 
  * eval_perf - Evaluate the performance of the registered transpose functions
  */
@@ -51,8 +118,16 @@ void eval_perf(unsigned int s, unsigned int E, unsigned int b)
     unsigned long long int marker_start, marker_end, addr;
     char buf[1000], cmd[255];
     char filename[128];
+    char key[64];
+    csim_config_t config = {0};
+    csim_stats_t stats;
+    csim_t *sim;
 
     registerFunctions(); 
+    config.s = s;
+    config.E = E;
+    config.b = b;
+    sprintf(key, "s=%u E=%u b=%u", s, E, b);
 
     /* Open the complete trace file */
     FILE* full_trace_fp;  
@@ -65,87 +140,100 @@ void eval_perf(unsigned int s, unsigned int E, unsigned int b)
             results.funcid = i; /* remember which function is the submission */
 
 
-        printf("\nFunction %d (%d total)\nStep 1: Validating and generating memory traces\n",i,func_counter);
-        /* Use valgrind to generate the trace */
+        if (capture) {
+            if (eval_capture(i, &config, &stats) == -1)
+                continue;
+        } else {
+            printf("\nFunction %d (%d total)\nStep 1: Validating and generating memory traces\n",i,func_counter);
+            /* Use valgrind to generate the trace */
 
-        sprintf(cmd, "valgrind --tool=lackey --trace-mem=yes --log-fd=1 -v ./tracegen -M %d -N %d -F %d  > trace.tmp", M, N,i);
-        flag=WEXITSTATUS(system(cmd));
-        if (0!=flag) {
-            printf("Validation error at function %d! Run ./tracegen -M %d -N %d -F %d for details.\nSkipping performance evaluation for this function.\n",flag-1,M,N,i);      
-            continue;
-        }
+            sprintf(cmd, "valgrind --tool=lackey --trace-mem=yes --log-fd=1 -v ./tracegen -M %d -N %d -F %d  > trace.tmp", M, N,i);
+            flag=WEXITSTATUS(system(cmd));
+            if (0!=flag) {
+                printf("Validation error at function %d! Run ./tracegen -M %d -N %d -F %d for details.\nSkipping performance evaluation for this function.\n",flag-1,M,N,i);      
+                continue;
+            }
 
-        /* Get the start and end marker addresses */
-        FILE* marker_fp = fopen(".marker", "r");
-        assert(marker_fp);
-        fscanf(marker_fp, "%llx %llx", &marker_start, &marker_end);
-        fclose(marker_fp);
+            /* Get the start and end marker addresses */
+            FILE* marker_fp = fopen(".marker", "r");
+            assert(marker_fp);
+            fscanf(marker_fp, "%llx %llx", &marker_start, &marker_end);
+            fclose(marker_fp);
 
 
-        func_list[i].correct=1;
+            func_list[i].correct=1;
 
-        /* Save the correctness of the transpose submission */
-        if (results.funcid == i ) {
-            results.correct = 1;
-        }
+            /* Save the correctness of the transpose submission */
+            if (results.funcid == i ) {
+                results.correct = 1;
+            }
 
-        full_trace_fp = fopen("trace.tmp", "r");
-        assert(full_trace_fp);
+            full_trace_fp = fopen("trace.tmp", "r");
+            assert(full_trace_fp);
 
 
-        /* Filtered trace for each transpose function goes in a separate file */
-        sprintf(filename, "trace.f%d", i);
-        part_trace_fp = fopen(filename, "w");
-        assert(part_trace_fp);
+            /* Filtered trace for each transpose function goes in a separate file */
+            sprintf(filename, "trace.f%d", i);
+            part_trace_fp = fopen(filename, "w");
+            assert(part_trace_fp);
+
     
-        /* Locate trace corresponding to the trans function */
-        flag = 0;
-        while (fgets(buf, 1000, full_trace_fp) != NULL) {
-
-            /* We are only interested in memory access instructions */
-            if (buf[0]==' ' && buf[2]==' ' &&
-                (buf[1]=='S' || buf[1]=='M' || buf[1]=='L' )) {
-                sscanf(buf+3, "%llx,%u", &addr, &len);
+            /* Locate trace corresponding to the trans function */
+            flag = 0;
+            while (fgets(buf, 1000, full_trace_fp) != NULL) {
+
+                /* We are only interested in memory access instructions */
+                if (buf[0]==' ' && buf[2]==' ' &&
+                    (buf[1]=='S' || buf[1]=='M' || buf[1]=='L' )) {
+                    sscanf(buf+3, "%llx,%u", &addr, &len);
         
-                /* If start marker found, set flag */
-                if (addr == marker_start)
-                    flag = 1;
-
-                /* Valgrind creates many spurious accesses to the
-                   stack that have nothing to do with the students
-                   code. At the moment, we are ignoring all stack
-                   accesses by using the simple filter of recording
-                   accesses to only the low 32-bit portion of the
-                   address space. At some point it would be nice to
-                   try to do more informed filtering so that would
-                   eliminate the valgrind stack references while
-                   include the student stack references. */
-                if (flag && addr < 0xffffffff) {
-                    fputs(buf, part_trace_fp);
+                    /* If start marker found, set flag */
+                    if (addr == marker_start)
+                        flag = 1;
+
+                    /* Valgrind creates many spurious accesses to the
+                       stack that have nothing to do with the students
+                       code. At the moment, we are ignoring all stack
+                       accesses by using the simple filter of recording
+                       accesses to only the low 32-bit portion of the
+                       address space. At some point it would be nice to
+                       try to do more informed filtering so that would
+                       eliminate the valgrind stack references while
+                       include the student stack references. */
+                    if (flag && addr < 0xffffffff) {
+                        fputs(buf, part_trace_fp);
+                    }
+
+                    /* if end marker found, close trace file */
+                    if (addr == marker_end) {
+                        flag = 0;
+                        fclose(part_trace_fp);
+                        break;
+                    }
                 }
-
-                /* if end marker found, close trace file */
-                if (addr == marker_end) {
-                    flag = 0;
-                    fclose(part_trace_fp);
-                    break;
+            }
+            fclose(full_trace_fp);
+
+            /* Run the simulator in-process, unless this exact trace has
+               been evaluated before */
+            printf("Step 2: Evaluating performance (s=%d, E=%d, b=%d)\n", s, E, b);
+            if (result_cache == NULL ||
+                csim_cache_lookup(result_cache, filename, key, &stats) != 1) {
+                sim = csim_create(&config);
+                assert(sim);
+                if (csim_access_file(sim, filename) == -1) {
+                    printf("Error: could not read %s\n", filename);
+                    exit(1);
                 }
+                csim_stats(sim, &stats);
+                csim_destroy(sim);
+                if (result_cache != NULL)
+                    csim_cache_store(result_cache, filename, key, &stats);
             }
         }
-        fclose(full_trace_fp);
-
-        /* Run the reference simulator */
-        printf("Step 2: Evaluating performance (s=%d, E=%d, b=%d)\n", s, E, b);
-        char cmd[255];
-        sprintf(cmd, "./csim-ref -s %u -E %u -b %u -t trace.f%d > /dev/null", 
-                s, E, b, i);
-        system(cmd);
-    
-        /* Collect results from the reference simulator */
-        FILE* in_fp = fopen(".csim_results","r");
-        assert(in_fp);
-        fscanf(in_fp, "%u %u %u", &hits, &misses, &evictions);
-        fclose(in_fp);
+        hits = stats.hits;
+        misses = stats.misses;
+        evictions = stats.evictions;
         func_list[i].num_hits = hits;
         func_list[i].num_misses = misses;
         func_list[i].num_evictions = evictions;
@@ -164,11 +252,14 @@ void eval_perf(unsigned int s, unsigned int E, unsigned int b)
  * usage - Print usage info
  */
 void usage(char *argv[]){
-    printf("Usage: %s [-h] -M <rows> -N <cols>\n", argv[0]);
+    printf("Usage: %s [-hc] -M <rows> -N <cols> [-C <dir>]\n", argv[0]);
     printf("Options:\n");
     printf("  -h          Print this help message.\n");
     printf("  -M <rows>   Number of matrix rows (max %d)\n", MAXN);
     printf("  -N <cols>   Number of  matrix columns (max %d)\n", MAXN);
+    printf("  -C <dir>    Reuse and store simulation results in <dir>\n");
+    printf("  -c          Trace in-process instead of under Valgrind. Counts only\n");
+    printf("              accesses made through TRANS_LOAD()/TRANS_STORE()\n");
     printf("Example: %s -M 8 -N 8\n", argv[0]);       
 }
 
@@ -199,7 +290,7 @@ int main(int argc, char* argv[])
 {
     char c;
 
-    while ((c = getopt(argc,argv,"M:N:h")) != -1) {
+    while ((c = getopt(argc,argv,"M:N:C:ch")) != -1) {
         switch(c) {
         case 'M':
             M = atoi(optarg);
@@ -207,6 +298,12 @@ int main(int argc, char* argv[])
         case 'N':
             N = atoi(optarg);
             break;
+        case 'C':
+            result_cache = optarg;
+            break;
+        case 'c':
+            capture = 1;
+            break;
         case 'h':
             usage(argv);
             exit(0);
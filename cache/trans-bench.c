@@ -0,0 +1,188 @@
+/*
+ * trans-bench.c - Wall-clock benchmark of the transpose functions
+ *
+ * Times every function trans.c registers, next to the naive correctTrans(),
+ * on matrices far larger than test-trans allows. trans.c is built with -O2
+ * here, with TRANS_LOAD() and TRANS_STORE() as plain array references. It is
+ * linked a second time with the accessors recording (trans-bench-capture.o,
+ * whose registerFunctions() is renamed registerCaptureFunctions()), and each
+ * function's recorded accesses are simulated on the lab's cache in-process.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include "cachelab.h"
+#include "cachesim.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_SHAPES 16
+// B starts at the first multiple of this past A, so 256x256 matrices are
+// laid out as test-trans lays them out
+#define MATRIX_ALIGN (256 * 256 * sizeof(int))
+
+extern trans_func_t func_list[MAX_TRANS_FUNCS];
+extern int func_counter;
+extern void registerFunctions();
+extern void registerCaptureFunctions();
+
+double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int compare_doubles(const void *x, const void *y)
+{
+	double dx = *(const double *) x, dy = *(const double *) y;
+	return (dx > dy) - (dx < dy);
+}
+
+// whether b (M rows of N) is the transpose of a (N rows of M)
+int is_transposed(int M, int N, int *a, int *b)
+{
+	for (long i = 0; i < N; ++i)
+		for (long j = 0; j < M; ++j)
+			if (b[j * N + i] != a[i * M + j])
+				return 0;
+	return 1;
+}
+
+// median seconds of repeats runs of trans; -1 if it does not transpose
+double time_trans(void (*trans)(int, int, int[*][*], int[*][*]), int M, int N, int *a, int *b,
+                  int repeats)
+{
+	double times[repeats];
+	memset(b, 0, (size_t) M * N * sizeof(int));
+	// the first run also faults in b, so it is not timed
+	trans(M, N, (int (*)[M]) a, (int (*)[N]) b);
+	if (!is_transposed(M, N, a, b))
+		return -1;
+	for (int r = 0; r < repeats; ++r) {
+		double start = now();
+		trans(M, N, (int (*)[M]) a, (int (*)[N]) b);
+		times[r] = now() - start;
+	}
+	qsort(times, repeats, sizeof(double), compare_doubles);
+	return times[repeats / 2];
+}
+
+// misses of the recording build of trans on the lab's cache, with addresses
+// relative to a as test-trans -c makes them; -1 if the accesses do not fit
+// in memory
+long long simulate(void (*trans)(int, int, int[*][*], int[*][*]), int M, int N, int *a, int *b)
+{
+	csim_config_t config = {0};
+	csim_ref_t *refs;
+	csim_stats_t stats;
+	size_t n;
+	config.s = 5;
+	config.E = 1;
+	config.b = 5;
+	config.split = 1;
+	startCapture();
+	trans(M, N, (int (*)[M]) a, (int (*)[N]) b);
+	if (stopCapture(&refs, &n) == -1)
+		return -1;
+	for (size_t k = 0; k < n; ++k)
+		refs[k].address -= (unsigned long long) a;
+	csim_t *sim = csim_create(&config);
+	if (sim == NULL) {
+		free(refs);
+		return -1;
+	}
+	csim_access_batch(sim, refs, n);
+	csim_stats(sim, &stats);
+	csim_destroy(sim);
+	free(refs);
+	return (long long) stats.misses;
+}
+
+void usage(char *argv[])
+{
+	fprintf(stderr, "usage: %s [-r <repeats>] [<M>x<N>...]\n", argv[0]);
+	fprintf(stderr, "  <M>x<N>   shapes to time (default 256x256 1024x1024 4096x4096 3001x2999 8192x512)\n");
+	fprintf(stderr, "Misses are simulated on the lab's cache (s=5, E=1, b=5).\n");
+	fprintf(stderr, "TRANS_SIMD=avx512|avx2|sse2|scalar caps the SIMD transpose's kernel.\n");
+}
+
+int main(int argc, char *argv[])
+{
+	int repeats = 5, opt;
+	while ((opt = getopt(argc, argv, "r:")) != -1)
+		switch (opt) {
+		case 'r':
+			if ((repeats = atoi(optarg)) < 1) {
+				usage(argv);
+				exit(EXIT_FAILURE);
+			}
+			break;
+		default:
+			usage(argv);
+			exit(EXIT_FAILURE);
+		}
+
+	int shapes[2 * MAX_SHAPES] = {256, 256, 1024, 1024, 4096, 4096, 3001, 2999, 8192, 512};
+	int nshapes = 5;
+	if (optind < argc) {
+		if (argc - optind > MAX_SHAPES) {
+			usage(argv);
+			exit(EXIT_FAILURE);
+		}
+		for (nshapes = 0; optind < argc; ++nshapes, ++optind) {
+			char extra;
+			int *shape = &shapes[2 * nshapes];
+			if (sscanf(argv[optind], "%dx%d%c", &shape[0], &shape[1], &extra) != 2 ||
+			    shape[0] < 1 || shape[1] < 1) {
+				usage(argv);
+				exit(EXIT_FAILURE);
+			}
+		}
+	}
+
+	// the recording builds follow the timed ones in func_list, in the same order
+	registerFunctions();
+	int nfuncs = func_counter;
+	registerCaptureFunctions();
+	if (func_counter != 2 * nfuncs) {
+		fprintf(stderr, "%s: error: the two builds of trans.c register different functions.\n",
+		        argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	for (int k = 0; k < nshapes; ++k) {
+		int M = shapes[2 * k], N = shapes[2 * k + 1];
+		size_t n = (size_t) M * N;
+		size_t span = (n * sizeof(int) + MATRIX_ALIGN - 1) / MATRIX_ALIGN * MATRIX_ALIGN;
+		int *a = (int *) malloc(span + n * sizeof(int)), *b = a + span / sizeof(int);
+		if (a == NULL) {
+			fprintf(stderr, "%s: error: cannot allocate %dx%d matrices.\n", argv[0], M, N);
+			exit(EXIT_FAILURE);
+		}
+		for (size_t x = 0; x < n; ++x)
+			a[x] = (int) x;
+
+		printf("%dx%d (%.1f MB per matrix)\n", M, N, n * sizeof(int) / 1e6);
+		double naive = time_trans(correctTrans, M, N, a, b, repeats);
+		for (int f = -1; f < nfuncs; ++f) {
+			const char *desc = f < 0 ? "Naive (correctTrans)" : func_list[f].description;
+			double t = f < 0 ? naive : time_trans(func_list[f].func_ptr, M, N, a, b, repeats);
+			if (t < 0) {
+				printf("  %-40s incorrect\n", desc);
+				continue;
+			}
+			// one read of A and one write of B
+			printf("  %-40s %9.3f ms %7.2f GB/s %6.2fx", desc, t * 1e3,
+			       2 * n * sizeof(int) / t / 1e9, t > 0 ? naive / t : 0.0);
+			long long misses = f < 0 ? -1 : simulate(func_list[nfuncs + f].func_ptr, M, N, a, b);
+			if (misses >= 0)
+				printf(" %9lld misses", misses);
+			printf("\n");
+			fflush(stdout);
+		}
+		free(a);
+	}
+	return 0;
+}
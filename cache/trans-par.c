@@ -0,0 +1,300 @@
+/*
+ * trans-par.c - Multithreaded tiled transpose and its scaling benchmark
+ *
+ * The lab's transposes are single-threaded and limited to 256x256. Here A is
+ * cut into bands of tile rows, each transposed tile by tile, and a pool of
+ * threads claims the bands one at a time. Stores to B can bypass the cache
+ * (non-temporal stores), which saves reading B's lines in before writing
+ * them when the matrices are far larger than the last-level cache. For each
+ * shape, the transpose is timed at 1, 2, 4, ... threads, with ordinary and
+ * with non-temporal stores, and reported as GB/s and speedup over 1 thread.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define MAX_THREADS 64
+#define MAX_SHAPES 16
+
+// one transpose of a (N rows of M) into b (M rows of N). bands of tile rows
+// of a are claimed in order through next
+typedef struct {
+	const int *a;
+	int *b;
+	int M, N;
+	int tile;
+	int stream;  // non-temporal stores to b
+	int bands;
+	int next;
+} Job;
+
+// threads that live across jobs. run_job() publishes a job by bumping
+// generation and waits until busy drops back to 0
+typedef struct {
+	pthread_t threads[MAX_THREADS];
+	int nthreads;
+	pthread_mutex_t lock;
+	pthread_cond_t start, done;
+	long generation;
+	int busy;
+	int quit;
+	Job *job;
+} Pool;
+
+double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int compare_doubles(const void *x, const void *y)
+{
+	double dx = *(const double *) x, dy = *(const double *) y;
+	return (dx > dy) - (dx < dy);
+}
+
+// rows [i0, i1) and columns [j0, j1) of a, writing b a row at a time so that
+// the stores to each row of b fill whole lines
+void transpose_tile(const Job *job, int i0, int i1, int j0, int j1)
+{
+	long M = job->M, N = job->N;
+	for (long j = j0; j < j1; ++j) {
+		int *row = job->b + j * N;
+#ifdef __SSE2__
+		if (job->stream) {
+			for (long i = i0; i < i1; ++i)
+				_mm_stream_si32(row + i, job->a[i * M + j]);
+			continue;
+		}
+#endif
+		for (long i = i0; i < i1; ++i)
+			row[i] = job->a[i * M + j];
+	}
+}
+
+void transpose_band(const Job *job, int band)
+{
+	int i0 = band * job->tile;
+	int i1 = i0 + job->tile < job->N ? i0 + job->tile : job->N;
+	for (int j0 = 0; j0 < job->M; j0 += job->tile)
+		transpose_tile(job, i0, i1, j0, j0 + job->tile < job->M ? j0 + job->tile : job->M);
+}
+
+void *worker(void *arg)
+{
+	Pool *pool = (Pool *) arg;
+	long seen = 0;
+	pthread_mutex_lock(&pool->lock);
+	for (;;) {
+		while (pool->generation == seen && !pool->quit)
+			pthread_cond_wait(&pool->start, &pool->lock);
+		if (pool->quit)
+			break;
+		seen = pool->generation;
+		Job *job = pool->job;
+		while (job->next < job->bands) {
+			int band = job->next++;
+			pthread_mutex_unlock(&pool->lock);
+			transpose_band(job, band);
+			pthread_mutex_lock(&pool->lock);
+		}
+#ifdef __SSE2__
+		// non-temporal stores are weakly ordered; make them visible before
+		// reporting the job done
+		if (job->stream)
+			_mm_sfence();
+#endif
+		if (--pool->busy == 0)
+			pthread_cond_signal(&pool->done);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return NULL;
+}
+
+void destroy_pool(Pool *pool)
+{
+	pthread_mutex_lock(&pool->lock);
+	pool->quit = 1;
+	pthread_cond_broadcast(&pool->start);
+	pthread_mutex_unlock(&pool->lock);
+	for (int t = 0; t < pool->nthreads; ++t)
+		pthread_join(pool->threads[t], NULL);
+	pthread_cond_destroy(&pool->start);
+	pthread_cond_destroy(&pool->done);
+	pthread_mutex_destroy(&pool->lock);
+}
+
+int create_pool(Pool *pool, int nthreads)
+{
+	memset(pool, 0, sizeof(Pool));
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->start, NULL);
+	pthread_cond_init(&pool->done, NULL);
+	for (; pool->nthreads < nthreads; ++pool->nthreads)
+		if (pthread_create(&pool->threads[pool->nthreads], NULL, worker, pool) != 0) {
+			destroy_pool(pool);
+			return -1;
+		}
+	return 0;
+}
+
+// transposes with every thread of the pool; returns once b is complete
+void run_job(Pool *pool, Job *job)
+{
+	job->bands = (job->N + job->tile - 1) / job->tile;
+	job->next = 0;
+	pthread_mutex_lock(&pool->lock);
+	pool->job = job;
+	pool->busy = pool->nthreads;
+	++pool->generation;
+	pthread_cond_broadcast(&pool->start);
+	while (pool->busy > 0)
+		pthread_cond_wait(&pool->done, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+int is_transposed(int M, int N, const int *a, const int *b)
+{
+	for (long i = 0; i < N; ++i)
+		for (long j = 0; j < M; ++j)
+			if (b[j * N + i] != a[i * M + j])
+				return 0;
+	return 1;
+}
+
+// median seconds of repeats runs of job on pool; -1 if b comes out wrong
+double time_job(Pool *pool, Job *job, int repeats)
+{
+	double times[repeats];
+	memset(job->b, 0, (size_t) job->M * job->N * sizeof(int));
+	run_job(pool, job);
+	if (!is_transposed(job->M, job->N, job->a, job->b))
+		return -1;
+	for (int r = 0; r < repeats; ++r) {
+		double start = now();
+		run_job(pool, job);
+		times[r] = now() - start;
+	}
+	qsort(times, repeats, sizeof(double), compare_doubles);
+	return times[repeats / 2];
+}
+
+void usage(char *argv[])
+{
+	fprintf(stderr, "usage: %s [-p <threads>] [-r <repeats>] [-t <tile>] [<M>x<N>...]\n", argv[0]);
+	fprintf(stderr, "  -p <threads>   most threads to time (default: online CPUs)\n");
+	fprintf(stderr, "  -r <repeats>   timed runs per thread count, median reported (default 3)\n");
+	fprintf(stderr, "  -t <tile>      tile side in elements (default 64)\n");
+	fprintf(stderr, "  <M>x<N>        shapes to time (default 8192x8192 12289x5003)\n");
+}
+
+int main(int argc, char *argv[])
+{
+	int max_threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+	int repeats = 3, tile = 64, opt;
+	while ((opt = getopt(argc, argv, "p:r:t:")) != -1)
+		switch (opt) {
+		case 'p':
+			if ((max_threads = atoi(optarg)) < 1) {
+				usage(argv);
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'r':
+			if ((repeats = atoi(optarg)) < 1) {
+				usage(argv);
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 't':
+			if ((tile = atoi(optarg)) < 1) {
+				usage(argv);
+				exit(EXIT_FAILURE);
+			}
+			break;
+		default:
+			usage(argv);
+			exit(EXIT_FAILURE);
+		}
+	if (max_threads < 1)
+		max_threads = 1;
+	if (max_threads > MAX_THREADS)
+		max_threads = MAX_THREADS;
+
+	int shapes[2 * MAX_SHAPES] = {8192, 8192, 12289, 5003};
+	int nshapes = 2;
+	if (optind < argc) {
+		if (argc - optind > MAX_SHAPES) {
+			usage(argv);
+			exit(EXIT_FAILURE);
+		}
+		for (nshapes = 0; optind < argc; ++nshapes, ++optind) {
+			char extra;
+			int *shape = &shapes[2 * nshapes];
+			if (sscanf(argv[optind], "%dx%d%c", &shape[0], &shape[1], &extra) != 2 ||
+			    shape[0] < 1 || shape[1] < 1) {
+				usage(argv);
+				exit(EXIT_FAILURE);
+			}
+		}
+	}
+
+	// 1, 2, 4, ... threads, and max_threads itself
+	int counts[MAX_THREADS], ncounts = 0;
+	for (int t = 1; t < max_threads; t *= 2)
+		counts[ncounts++] = t;
+	counts[ncounts++] = max_threads;
+
+	for (int k = 0; k < nshapes; ++k) {
+		int M = shapes[2 * k], N = shapes[2 * k + 1];
+		size_t n = (size_t) M * N;
+		int *a = (int *) malloc(n * sizeof(int)), *b = (int *) malloc(n * sizeof(int));
+		if (a == NULL || b == NULL) {
+			fprintf(stderr, "%s: error: cannot allocate %dx%d matrices.\n", argv[0], M, N);
+			exit(EXIT_FAILURE);
+		}
+		for (size_t x = 0; x < n; ++x)
+			a[x] = (int) x;
+
+		printf("%dx%d (%.1f MB per matrix, %dx%d tiles)\n", M, N, n * sizeof(int) / 1e6, tile,
+		       tile);
+		printf("  %7s %10s %8s %8s %10s %8s %8s\n", "threads", "ms", "GB/s", "speedup", "ms (nt)",
+		       "GB/s", "speedup");
+		double base[2] = {0, 0};
+		for (int c = 0; c < ncounts; ++c) {
+			Pool pool;
+			if (create_pool(&pool, counts[c]) < 0) {
+				fprintf(stderr, "%s: error: cannot start %d threads.\n", argv[0], counts[c]);
+				exit(EXIT_FAILURE);
+			}
+			printf("  %7d", counts[c]);
+			for (int stream = 0; stream < 2; ++stream) {
+				Job job = {a, b, M, N, tile, stream};
+				double t = time_job(&pool, &job, repeats);
+				if (t < 0) {
+					printf(" %28s", "incorrect");
+					continue;
+				}
+				if (c == 0)
+					base[stream] = t;
+				// one read of A and one write of B
+				printf(" %10.3f %8.2f %7.2fx", t * 1e3, 2 * n * sizeof(int) / t / 1e9,
+				       t > 0 ? base[stream] / t : 0.0);
+			}
+			printf("\n");
+			fflush(stdout);
+			destroy_pool(&pool);
+		}
+		free(a);
+		free(b);
+	}
+	return 0;
+}
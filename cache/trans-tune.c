@@ -0,0 +1,610 @@
+/*
+ * trans-tune.c - Searches transpose kernels against the cache simulator
+ *
+ * For each MxN shape, every variant of a small family of kernels (see
+ * Variant) is run on real matrices with its loads and stores recorded,
+ * checked, and replayed into an in-process simulator of the given cache.
+ * A pool of threads works through the variants. The kernel with the fewest
+ * misses per shape is written out as C that reads A and writes B through
+ * TRANS_LOAD() and TRANS_STORE(), ready to paste into trans.c.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include "cachesim.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MAXN 256
+#define MAX_THREADS 64
+#define MAX_SHAPES 16
+// locals a kernel may buffer elements in; with its loop variables that
+// stays within the lab's limit of 12
+#define MAX_REGS 8
+// largest tile side tried, besides the whole matrix
+#define MAX_TILE 32
+
+enum {
+	TUNE_BLOCKED,   // element by element within each tile
+	TUNE_BUFFERED,  // a row (or column) segment of A at a time, through locals
+	TUNE_STAGED,    // 2h x 2h blocks, parked in the top-right quarter of B
+};
+
+// one candidate kernel. tiles of bh rows by bw columns of A are visited
+// row of tiles by row of tiles (tile_order 0) or column by column. within a
+// tile, TUNE_BLOCKED walks rows of A (inner 0) or columns, optionally
+// storing the diagonal element of each row or column last. TUNE_BUFFERED
+// loads a row segment of bw (inner 0) or a column segment of bh elements
+// into locals before storing them. TUNE_STAGED uses square tiles of 2h with
+// h <= MAX_REGS / 2 and stores the top-right quarter of each A tile in
+// the top-right quarter of the B tile until the bottom-left one is read
+typedef struct {
+	int strategy;
+	int bh;
+	int bw;
+	int tile_order;
+	int inner;
+	int defer_diag;
+	int index;  // enumeration order, to break ties
+	int wrong;  // does not transpose; dropped from the search
+	csim_stats_t stats;
+} Variant;
+
+// the loads and stores of one kernel run, addresses relative to A
+typedef struct {
+	csim_ref_t *refs;
+	size_t n;
+	unsigned long long base;
+} Recorder;
+
+typedef struct {
+	Variant *variants;
+	int nvariants;
+	int next;  // first variant not yet taken by a worker
+	int failed;
+	pthread_mutex_t lock;
+	int M;
+	int N;
+	csim_config_t config;
+} Search;
+
+int record_load(Recorder *rec, int *p)
+{
+	csim_ref_t *ref = &rec->refs[rec->n++];
+	ref->address = (unsigned long long) p - rec->base;
+	ref->op = 'L';
+	ref->size = sizeof(int);
+	return *p;
+}
+
+void record_store(Recorder *rec, int *p, int v)
+{
+	csim_ref_t *ref = &rec->refs[rec->n++];
+	ref->address = (unsigned long long) p - rec->base;
+	ref->op = 'S';
+	ref->size = sizeof(int);
+	*p = v;
+}
+
+// A is N rows of M ints and B is M rows of N, both at stride M or N, as a
+// transpose function indexes them
+#define A_AT(i, j) (a + (i) * M + (j))
+#define B_AT(j, i) (b + (j) * N + (i))
+#define COPY(i, j) record_store(rec, B_AT(j, i), record_load(rec, A_AT(i, j)))
+
+int min_int(int x, int y)
+{
+	return x < y ? x : y;
+}
+
+void run_blocked(Variant *v, int M, int N, int *a, int *b, int i, int j, Recorder *rec)
+{
+	int ie = min_int(i + v->bh, N), je = min_int(j + v->bw, M);
+	for (int x = v->inner ? j : i; x < (v->inner ? je : ie); ++x) {
+		int diag = 0;
+		for (int y = v->inner ? i : j; y < (v->inner ? ie : je); ++y) {
+			if (v->defer_diag && x == y)
+				diag = 1;
+			else if (v->inner)
+				COPY(y, x);
+			else
+				COPY(x, y);
+		}
+		if (diag)
+			COPY(x, x);
+	}
+}
+
+void run_buffered(Variant *v, int M, int N, int *a, int *b, int i, int j, Recorder *rec)
+{
+	int t[MAX_REGS];
+	if (v->inner == 0)
+		for (int ii = i; ii < min_int(i + v->bh, N); ++ii) {
+			for (int k = 0; k < v->bw; ++k)
+				t[k] = record_load(rec, A_AT(ii, j + k));
+			for (int k = 0; k < v->bw; ++k)
+				record_store(rec, B_AT(j + k, ii), t[k]);
+		}
+	else
+		for (int jj = j; jj < min_int(j + v->bw, M); ++jj) {
+			for (int k = 0; k < v->bh; ++k)
+				t[k] = record_load(rec, A_AT(i + k, jj));
+			for (int k = 0; k < v->bh; ++k)
+				record_store(rec, B_AT(jj, i + k), t[k]);
+		}
+}
+
+void run_staged(Variant *v, int M, int N, int *a, int *b, int i, int j, Recorder *rec)
+{
+	int h = v->bw / 2, t[MAX_REGS];
+	for (int k = 0; k < h; ++k) {
+		for (int m = 0; m < 2 * h; ++m)
+			t[m] = record_load(rec, A_AT(i + k, j + m));
+		for (int m = 0; m < h; ++m)
+			record_store(rec, B_AT(j + m, i + k), t[m]);
+		for (int m = 0; m < h; ++m)
+			record_store(rec, B_AT(j + m, i + h + k), t[h + m]);
+	}
+	for (int k = 0; k < h; ++k) {
+		for (int m = 0; m < h; ++m)
+			t[m] = record_load(rec, B_AT(j + k, i + h + m));
+		for (int m = 0; m < h; ++m)
+			t[h + m] = record_load(rec, A_AT(i + h + m, j + k));
+		for (int m = 0; m < h; ++m)
+			record_store(rec, B_AT(j + k, i + h + m), t[h + m]);
+		for (int m = 0; m < h; ++m)
+			record_store(rec, B_AT(j + h + k, i + m), t[m]);
+	}
+	for (int k = h; k < 2 * h; ++k) {
+		for (int m = 0; m < h; ++m)
+			t[m] = record_load(rec, A_AT(i + k, j + h + m));
+		for (int m = 0; m < h; ++m)
+			record_store(rec, B_AT(j + h + m, i + k), t[m]);
+	}
+}
+
+void run_variant(Variant *v, int M, int N, int *a, int *b, Recorder *rec)
+{
+	int outer = v->tile_order ? M : N, inner = v->tile_order ? N : M;
+	int outer_step = v->tile_order ? v->bw : v->bh, inner_step = v->tile_order ? v->bh : v->bw;
+	for (int x = 0; x < outer; x += outer_step)
+		for (int y = 0; y < inner; y += inner_step) {
+			int i = v->tile_order ? y : x, j = v->tile_order ? x : y;
+			if (v->strategy == TUNE_BLOCKED)
+				run_blocked(v, M, N, a, b, i, j, rec);
+			else if (v->strategy == TUNE_BUFFERED)
+				run_buffered(v, M, N, a, b, i, j, rec);
+			else
+				run_staged(v, M, N, a, b, i, j, rec);
+		}
+}
+
+void describe(char *buf, size_t len, Variant *v)
+{
+	const char *orders[] = {"tiles by rows", "tiles by columns"};
+	if (v->strategy == TUNE_BLOCKED)
+		snprintf(buf, len, "blocked %dx%d, %s, %s inner%s", v->bh, v->bw, orders[v->tile_order],
+		         v->inner ? "column" : "row", v->defer_diag ? ", diagonal deferred" : "");
+	else if (v->strategy == TUNE_BUFFERED)
+		snprintf(buf, len, "buffered %dx%d, %s, %s segments", v->bh, v->bw, orders[v->tile_order],
+		         v->inner ? "column" : "row");
+	else
+		snprintf(buf, len, "staged %dx%d, %s", v->bh, v->bw, orders[v->tile_order]);
+}
+
+// runs v on fresh matrices and scores its references. a variant that does
+// not transpose is logged and marked wrong rather than failing the search;
+// returns -1 only if the simulator cannot be created
+int score_variant(Search *search, Variant *v, int *mem, Recorder *rec)
+{
+	int M = search->M, N = search->N;
+	int *a = mem, *b = mem + MAXN * MAXN;
+	for (int x = 0; x < M * N; ++x) {
+		a[x] = x + 1;
+		b[x] = 0;
+	}
+	rec->n = 0;
+	rec->base = (unsigned long long) mem;
+	run_variant(v, M, N, a, b, rec);
+	for (int i = 0; i < N; ++i)
+		for (int j = 0; j < M; ++j)
+			if (*B_AT(j, i) != *A_AT(i, j)) {
+				char desc[128];
+				describe(desc, sizeof(desc), v);
+				fprintf(stderr, "%dx%d: skipping %s: B[%d][%d] is wrong\n", M, N, desc, j, i);
+				v->wrong = 1;
+				return 0;
+			}
+	csim_t *sim = csim_create(&search->config);
+	if (sim == NULL)
+		return -1;
+	csim_access_batch(sim, rec->refs, rec->n);
+	csim_stats(sim, &v->stats);
+	csim_destroy(sim);
+	return 0;
+}
+
+void *worker(void *arg)
+{
+	Search *search = (Search *) arg;
+	// laid out as test-trans -c lays out A and B, so scores carry over
+	int *mem = (int *) malloc(2 * MAXN * MAXN * sizeof(int));
+	Recorder rec;
+	// staged kernels make the most references, 3 per element
+	rec.refs = (csim_ref_t *) malloc(3 * MAXN * MAXN * sizeof(csim_ref_t));
+	int failed = mem == NULL || rec.refs == NULL;
+	for (;;) {
+		pthread_mutex_lock(&search->lock);
+		if (failed)
+			search->failed = 1;
+		int next = search->next++;
+		int done = next >= search->nvariants || search->failed;
+		pthread_mutex_unlock(&search->lock);
+		if (done)
+			break;
+		failed = score_variant(search, &search->variants[next], mem, &rec) == -1;
+	}
+	free(mem);
+	free(rec.refs);
+	return NULL;
+}
+
+void add_variant(Search *search, int strategy, int bh, int bw, int tile_order, int inner,
+                 int defer_diag)
+{
+	Variant *v = &search->variants[search->nvariants++];
+	memset(v, 0, sizeof(Variant));
+	v->strategy = strategy;
+	v->bh = bh;
+	v->bw = bw;
+	v->tile_order = tile_order;
+	v->inner = inner;
+	v->defer_diag = defer_diag;
+	v->index = search->nvariants - 1;
+}
+
+// tile sides tried along a dimension: every size up to MAX_TILE, and the
+// whole dimension
+int tile_sizes(int dim, int *sizes)
+{
+	int n = 0;
+	for (int size = 1; size <= dim && size <= MAX_TILE; ++size)
+		sizes[n++] = size;
+	if (dim > MAX_TILE)
+		sizes[n++] = dim;
+	return n;
+}
+
+// every variant that applies to an MxN matrix. buffered segments and staged
+// tiles must divide the matrix evenly
+int enumerate_variants(Search *search)
+{
+	int M = search->M, N = search->N;
+	int heights[MAX_TILE + 1], widths[MAX_TILE + 1];
+	int nh = tile_sizes(N, heights), nw = tile_sizes(M, widths);
+	// per tile order: 4 blocked and 2 buffered variants per tile shape, and
+	// the staged ones
+	int cap = 2 * (nh * nw * 6 + MAX_REGS / 2);
+	search->nvariants = 0;
+	if ((search->variants = (Variant *) malloc(cap * sizeof(Variant))) == NULL)
+		return -1;
+	for (int order = 0; order < 2; ++order) {
+		for (int y = 0; y < nh; ++y)
+			for (int x = 0; x < nw; ++x) {
+				int h = heights[y], w = widths[x];
+				for (int inner = 0; inner < 2; ++inner)
+					for (int defer = 0; defer < 2; ++defer)
+						add_variant(search, TUNE_BLOCKED, h, w, order, inner, defer);
+				if (w > 1 && w <= MAX_REGS && M % w == 0)
+					add_variant(search, TUNE_BUFFERED, h, w, order, 0, 0);
+				if (h > 1 && h <= MAX_REGS && N % h == 0)
+					add_variant(search, TUNE_BUFFERED, h, w, order, 1, 0);
+			}
+		for (int h = 1; 2 * h <= MAX_REGS; ++h)
+			if (M % (2 * h) == 0 && N % (2 * h) == 0)
+				add_variant(search, TUNE_STAGED, 2 * h, 2 * h, order, 0, 0);
+	}
+	return 0;
+}
+
+int run_search(Search *search, int nthreads)
+{
+	pthread_t threads[MAX_THREADS];
+	search->next = 0;
+	search->failed = 0;
+	if (nthreads > search->nvariants)
+		nthreads = search->nvariants;
+	int started = 0;
+	for (; started < nthreads; ++started)
+		if (pthread_create(&threads[started], NULL, worker, search) != 0)
+			break;
+	if (started == 0)
+		return -1;
+	for (int t = 0; t < started; ++t)
+		pthread_join(threads[t], NULL);
+	if (search->failed)
+		return -1;
+	int kept = 0;
+	for (int v = 0; v < search->nvariants; ++v)
+		if (!search->variants[v].wrong)
+			search->variants[kept++] = search->variants[v];
+	search->nvariants = kept;
+	return kept > 0 ? 0 : -1;
+}
+
+// fewest misses first, then fewest evictions, then enumeration order, so
+// the result does not depend on the number of threads
+int compare_variants(const void *x, const void *y)
+{
+	const Variant *vx = x, *vy = y;
+	if (vx->stats.misses != vy->stats.misses)
+		return vx->stats.misses < vy->stats.misses ? -1 : 1;
+	if (vx->stats.evictions != vy->stats.evictions)
+		return vx->stats.evictions < vy->stats.evictions ? -1 : 1;
+	return vx->index - vy->index;
+}
+
+// "<var>", "<var> + <k>", or "<var> + <k> + <var2>"
+const char *term(char *buf, const char *var, int k, const char *var2)
+{
+	int n = snprintf(buf, 32, "%s", var);
+	if (k)
+		n += snprintf(buf + n, 32 - n, " + %d", k);
+	if (var2)
+		snprintf(buf + n, 32 - n, " + %s", var2);
+	return buf;
+}
+
+// a loop over one tile side; bounds-checked only if tiles do not divide it
+void emit_tile_loop(FILE *out, int depth, const char *var, const char *start, int size,
+                    const char *dim, int dim_size)
+{
+	fprintf(out, "%*s" "for (%s = %s; %s < %s + %d", depth, "", var, start, var, start, size);
+	if (dim_size % size)
+		fprintf(out, " && %s < %s", var, dim);
+	fprintf(out, "; ++%s) {\n", var);
+}
+
+void emit_temps(FILE *out, int n)
+{
+	for (int k = 0; k < n; ++k)
+		fprintf(out, ", t%d", k);
+}
+
+void emit_load(FILE *out, int depth, int t, const char *mat, const char *row, const char *col)
+{
+	fprintf(out, "%*st%d = TRANS_LOAD(%s, %s, %s);\n", depth, "", t, mat, row, col);
+}
+
+void emit_store(FILE *out, int depth, const char *row, const char *col, int t)
+{
+	fprintf(out, "%*sTRANS_STORE(B, %s, %s, t%d);\n", depth, "", row, col, t);
+}
+
+void emit_tile(FILE *out, Variant *v, int M, int N)
+{
+	char r[32], c[32];
+	int d = 3 * 4;  // inside the function and both tile loops
+	if (v->strategy == TUNE_BLOCKED) {
+		const char *x = v->inner ? "jj" : "ii";
+		if (v->inner)
+			emit_tile_loop(out, d, "jj", "j", v->bw, "M", M);
+		else
+			emit_tile_loop(out, d, "ii", "i", v->bh, "N", N);
+		if (v->defer_diag)
+			fprintf(out, "%*sdiag = 0;\n", d + 4, "");
+		if (v->inner)
+			emit_tile_loop(out, d + 4, "ii", "i", v->bh, "N", N);
+		else
+			emit_tile_loop(out, d + 4, "jj", "j", v->bw, "M", M);
+		if (v->defer_diag)
+			fprintf(out, "%*sif (ii == jj)\n%*sdiag = 1;\n%*selse\n%*s"
+			        "TRANS_STORE(B, jj, ii, TRANS_LOAD(A, ii, jj));\n",
+			        d + 8, "", d + 12, "", d + 8, "", d + 12, "");
+		else
+			fprintf(out, "%*sTRANS_STORE(B, jj, ii, TRANS_LOAD(A, ii, jj));\n", d + 8, "");
+		fprintf(out, "%*s}\n", d + 4, "");
+		if (v->defer_diag)
+			fprintf(out, "%*sif (diag)\n%*sTRANS_STORE(B, %s, %s, TRANS_LOAD(A, %s, %s));\n",
+			        d + 4, "", d + 8, "", x, x, x, x);
+		fprintf(out, "%*s}\n", d, "");
+	} else if (v->strategy == TUNE_BUFFERED) {
+		int n = v->inner ? v->bh : v->bw;
+		if (v->inner)
+			emit_tile_loop(out, d, "jj", "j", v->bw, "M", M);
+		else
+			emit_tile_loop(out, d, "ii", "i", v->bh, "N", N);
+		for (int k = 0; k < n; ++k)
+			if (v->inner)
+				emit_load(out, d + 4, k, "A", term(r, "i", k, NULL), "jj");
+			else
+				emit_load(out, d + 4, k, "A", "ii", term(c, "j", k, NULL));
+		for (int k = 0; k < n; ++k)
+			if (v->inner)
+				emit_store(out, d + 4, "jj", term(c, "i", k, NULL), k);
+			else
+				emit_store(out, d + 4, term(r, "j", k, NULL), "ii", k);
+		fprintf(out, "%*s}\n", d, "");
+	} else {
+		int h = v->bw / 2;
+		fprintf(out, "%*sfor (k = 0; k < %d; ++k) {\n", d, "", h);
+		for (int m = 0; m < 2 * h; ++m)
+			emit_load(out, d + 4, m, "A", "i + k", term(c, "j", m, NULL));
+		for (int m = 0; m < h; ++m)
+			emit_store(out, d + 4, term(r, "j", m, NULL), "i + k", m);
+		for (int m = 0; m < h; ++m)
+			emit_store(out, d + 4, term(r, "j", m, NULL), term(c, "i", h, "k"), h + m);
+		fprintf(out, "%*s}\n", d, "");
+		fprintf(out, "%*sfor (k = 0; k < %d; ++k) {\n", d, "", h);
+		for (int m = 0; m < h; ++m)
+			emit_load(out, d + 4, m, "B", "j + k", term(c, "i", h + m, NULL));
+		for (int m = 0; m < h; ++m)
+			emit_load(out, d + 4, h + m, "A", term(r, "i", h + m, NULL), "j + k");
+		for (int m = 0; m < h; ++m)
+			emit_store(out, d + 4, "j + k", term(c, "i", h + m, NULL), h + m);
+		for (int m = 0; m < h; ++m)
+			emit_store(out, d + 4, term(r, "j", h, "k"), term(c, "i", m, NULL), m);
+		fprintf(out, "%*s}\n", d, "");
+		fprintf(out, "%*sfor (k = %d; k < %d; ++k) {\n", d, "", h, 2 * h);
+		for (int m = 0; m < h; ++m)
+			emit_load(out, d + 4, m, "A", "i + k", term(c, "j", h + m, NULL));
+		for (int m = 0; m < h; ++m)
+			emit_store(out, d + 4, term(r, "j", h + m, NULL), "i + k", m);
+		fprintf(out, "%*s}\n", d, "");
+	}
+}
+
+void emit_variant(FILE *out, Variant *v, int M, int N, csim_config_t *config)
+{
+	char desc[128];
+	describe(desc, sizeof(desc), v);
+	fprintf(out, "/*\n * trans_tuned_%dx%d - %s\n", M, N, desc);
+	fprintf(out, " *     %llu misses on a (s=%d, E=%d, b=%d) cache\n */\n",
+	        v->stats.misses, config->s, config->E, config->b);
+	fprintf(out, "void trans_tuned_%dx%d(int M, int N, int A[N][M], int B[M][N])\n{\n", M, N);
+	if (v->strategy == TUNE_BLOCKED)
+		fprintf(out, "    int i, j, ii, jj%s;\n\n", v->defer_diag ? ", diag" : "");
+	else if (v->strategy == TUNE_BUFFERED) {
+		fprintf(out, "    int i, j, %s", v->inner ? "jj" : "ii");
+		emit_temps(out, v->inner ? v->bh : v->bw);
+		fprintf(out, ";\n\n");
+	} else {
+		fprintf(out, "    int i, j, k");
+		emit_temps(out, v->bw);
+		fprintf(out, ";\n\n");
+	}
+	if (v->tile_order) {
+		fprintf(out, "    for (j = 0; j < M; j += %d) {\n", v->bw);
+		fprintf(out, "        for (i = 0; i < N; i += %d) {\n", v->bh);
+	} else {
+		fprintf(out, "    for (i = 0; i < N; i += %d) {\n", v->bh);
+		fprintf(out, "        for (j = 0; j < M; j += %d) {\n", v->bw);
+	}
+	emit_tile(out, v, M, N);
+	fprintf(out, "        }\n    }\n}\n\n");
+}
+
+void emit_dispatch(FILE *out, int *shapes, int nshapes)
+{
+	fprintf(out, "/*\n * transpose_tuned - Dispatches to the tuned kernel for M and N\n */\n");
+	fprintf(out, "void transpose_tuned(int M, int N, int A[N][M], int B[M][N])\n{\n");
+	for (int k = 0; k < nshapes; ++k)
+		fprintf(out, "    %sif (M == %d && N == %d)\n        trans_tuned_%dx%d(M, N, A, B);\n",
+		        k ? "else " : "", shapes[2 * k], shapes[2 * k + 1], shapes[2 * k], shapes[2 * k + 1]);
+	fprintf(out, "}\n");
+}
+
+void usage(char *argv[])
+{
+	fprintf(stderr, "usage: %s [-s <num>] [-E <num>] [-b <num>] [-p <threads>] [-n <num>]"
+	        " [-o <file>] [<M>x<N>...]\n", argv[0]);
+	fprintf(stderr, "  -s, -E, -b   cache to tune for (default 5, 1, 5, the lab's)\n");
+	fprintf(stderr, "  -n <num>     also list the best <num> variants per shape\n");
+	fprintf(stderr, "  <M>x<N>      shapes to tune (default 32x32 64x64 61x67)\n");
+}
+
+int main(int argc, char *argv[])
+{
+	const char *out_path = NULL;
+	int nthreads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+	int list = 0, opt;
+	csim_config_t config = {0};
+	config.s = 5;
+	config.E = 1;
+	config.b = 5;
+	while ((opt = getopt(argc, argv, "s:E:b:p:n:o:")) != -1)
+		switch (opt) {
+		case 's':
+			config.s = atoi(optarg);
+			break;
+		case 'E':
+			config.E = atoi(optarg);
+			break;
+		case 'b':
+			config.b = atoi(optarg);
+			break;
+		case 'p':
+			if ((nthreads = atoi(optarg)) < 1) {
+				usage(argv);
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'n':
+			list = atoi(optarg);
+			break;
+		case 'o':
+			out_path = optarg;
+			break;
+		default:
+			usage(argv);
+			exit(EXIT_FAILURE);
+		}
+	if (nthreads < 1)
+		nthreads = 1;
+	if (nthreads > MAX_THREADS)
+		nthreads = MAX_THREADS;
+
+	int shapes[2 * MAX_SHAPES] = {32, 32, 64, 64, 61, 67};
+	int nshapes = 3;
+	if (optind < argc) {
+		if (argc - optind > MAX_SHAPES) {
+			usage(argv);
+			exit(EXIT_FAILURE);
+		}
+		for (nshapes = 0; optind < argc; ++nshapes, ++optind) {
+			char extra;
+			int *shape = &shapes[2 * nshapes];
+			if (sscanf(argv[optind], "%dx%d%c", &shape[0], &shape[1], &extra) != 2 ||
+			    shape[0] < 1 || shape[1] < 1 || shape[0] > MAXN || shape[1] > MAXN) {
+				usage(argv);
+				exit(EXIT_FAILURE);
+			}
+		}
+	}
+	csim_t *probe = csim_create(&config);
+	if (probe == NULL) {
+		fprintf(stderr, "%s: error: invalid cache parameters.\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	csim_destroy(probe);
+
+	FILE *out = stdout;
+	if (out_path != NULL && (out = fopen(out_path, "w")) == NULL) {
+		fprintf(stderr, "%s: error: failed to open %s.\n", argv[0], out_path);
+		exit(EXIT_FAILURE);
+	}
+	fprintf(out, "/* Generated by trans-tune for a (s=%d, E=%d, b=%d) cache */\n\n",
+	        config.s, config.E, config.b);
+
+	Search search;
+	pthread_mutex_init(&search.lock, NULL);
+	search.config = config;
+	for (int k = 0; k < nshapes; ++k) {
+		search.M = shapes[2 * k];
+		search.N = shapes[2 * k + 1];
+		if (enumerate_variants(&search) == -1 || run_search(&search, nthreads) == -1) {
+			fprintf(stderr, "%s: error: search failed for %dx%d.\n", argv[0], search.M, search.N);
+			exit(EXIT_FAILURE);
+		}
+		qsort(search.variants, search.nvariants, sizeof(Variant), compare_variants);
+		Variant *best = &search.variants[0];
+		char desc[128];
+		describe(desc, sizeof(desc), best);
+		fprintf(stderr, "%dx%d: %d variants, best: %s, hits:%llu misses:%llu evictions:%llu\n",
+		        search.M, search.N, search.nvariants, desc, best->stats.hits,
+		        best->stats.misses, best->stats.evictions);
+		emit_variant(out, best, search.M, search.N, &config);
+		for (int v = 1; v < list && v < search.nvariants; ++v) {
+			describe(desc, sizeof(desc), &search.variants[v]);
+			fprintf(stderr, "  %3d. misses:%llu evictions:%llu  %s\n", v + 1,
+			        search.variants[v].stats.misses, search.variants[v].stats.evictions, desc);
+		}
+		free(search.variants);
+	}
+	emit_dispatch(out, shapes, nshapes);
+	pthread_mutex_destroy(&search.lock);
+	if (out != stdout)
+		fclose(out);
+	return 0;
+}
@@ -5,9 +5,16 @@
  * void trans(int M, int N, int A[N][M], int B[M][N]);
  *
  * A transpose function is evaluated by counting the number of misses
- * on a 1KB direct mapped cache with a block size of 32 bytes.
+ * on a 1KB direct mapped cache with a block size of 32 bytes. Reading A
+ * and writing B through TRANS_LOAD() and TRANS_STORE() lets
+ * test-trans -c trace the function in-process instead of under Valgrind.
  */ 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
 #include "cachelab.h"
 
 int is_transpose(int M, int N, int A[N][M], int B[M][N]);
@@ -15,6 +22,20 @@ void trans32(int A[32][32], int B[32][32]);
 void trans64(int A[64][64], int B[64][64]);
 void trans61x67(int A[67][61], int B[61][67]);
 void block4x4(int i, int j, int A[64][64], int B[64][64]);
+void trans_blocked(int M, int N, int A[N][M], int B[M][N]);
+void trans_recursive(int M, int N, int A[N][M], int B[M][N]);
+void trans_region(int M, int N, int A[N][M], int B[M][N], int i0, int i1, int j0, int j1);
+void trans_simd(int M, int N, int A[N][M], int B[M][N]);
+void trans_tiled(int M, int N, int A[N][M], int B[M][N], int T, void (*kernel)(int *, int, int *, int));
+void simd_select(void);
+
+// Side of the largest leaf trans_region() transposes directly: one 32-byte
+// block of ints, so a leaf's rows of A and of B each span a single block
+#define LEAF 8
+
+// Side of the groups of micro-kernel tiles trans_tiled() finishes before
+// moving on: 64 rows of B, 16KB of ints, stay in a typical L1
+#define SIMD_BLOCK 64
 
 /* 
  * transpose_submit - This is the solution transpose function that you
@@ -32,6 +53,13 @@ void transpose_submit(int M, int N, int A[N][M], int B[M][N])
 		trans64(A, B);
 	} else if (M==61 && N==67) {
 		trans61x67(A, B);
+	} else if (M % LEAF != 0 && N >= 32) {
+		// Rows of A that straddle blocks: the lab's cache is too small for
+		// recursion to pay off, and sweeping bands of 8x8 tiles reuses the
+		// straddling blocks sooner
+		trans_blocked(M, N, A, B);
+	} else {
+		trans_recursive(M, N, A, B);
 	}
 }
 
@@ -48,11 +76,11 @@ void trans32(int A[32][32], int B[32][32])
 						diag = 1;
 						d_index = ii;
 					} else {
-						B[jj][ii] = A[ii][jj];
+						TRANS_STORE(B, jj, ii, TRANS_LOAD(A, ii, jj));
 					}
 				}
 				if (diag) {
-					B[d_index][d_index] = A[d_index][d_index];
+					TRANS_STORE(B, d_index, d_index, TRANS_LOAD(A, d_index, d_index));
 					diag = 0;
 				}
 			}
@@ -86,7 +114,7 @@ void trans61x67(int A[67][61], int B[61][67])
 		for (j = 0; j < 61; j += 16) {
 			for (ii = i; (ii < i+16) && (ii < 67); ++ii) {
 				for (jj = j; (jj < j+16) && (jj < 61); ++jj) {
-					B[jj][ii] = A[ii][jj];
+					TRANS_STORE(B, jj, ii, TRANS_LOAD(A, ii, jj));
 				}
 			}
 		}
@@ -105,13 +133,250 @@ void block4x4(int i, int j, int A[64][64], int B[64][64])
 			if (ii == jj) {
 				// perform this assignment after the other 3
 			} else {
-				B[j+jj][i+ii] = A[i+ii][j+jj];
+				TRANS_STORE(B, j+jj, i+ii, TRANS_LOAD(A, i+ii, j+jj));
 			}
 		}
 		// each block's diagonal case; only necessary for certain blocks along the
 		// diagonal of the whole 64x64 array, but it simplifies the code to just do
 		// them all this way. i'm pretty sure it won't result in unnecessary misses
-		B[j+ii][i+ii] = A[i+ii][j+ii];
+		TRANS_STORE(B, j+ii, i+ii, TRANS_LOAD(A, i+ii, j+ii));
+	}
+}
+
+// Transposes any M x N matrix in 8x8 tiles, clipped at the edges. The
+// baseline the recursive transpose is compared against.
+char trans_blocked_desc[] = "Blocked 8x8 transpose";
+void trans_blocked(int M, int N, int A[N][M], int B[M][N])
+{
+	int i, j, ii, jj;
+
+	for (i = 0; i < N; i += 8) {
+		for (j = 0; j < M; j += 8) {
+			for (ii = i; ii < i+8 && ii < N; ++ii) {
+				for (jj = j; jj < j+8 && jj < M; ++jj) {
+					TRANS_STORE(B, jj, ii, TRANS_LOAD(A, ii, jj));
+				}
+			}
+		}
+	}
+}
+
+// Cache-oblivious transpose for any M x N: halves the longer side of A until
+// the pieces fit a LEAF x LEAF tile, so that at some depth they fit every
+// level of cache, whatever its size.
+char trans_recursive_desc[] = "Recursive cache-oblivious transpose";
+void trans_recursive(int M, int N, int A[N][M], int B[M][N])
+{
+	trans_region(M, N, A, B, 0, N, 0, M);
+}
+
+// Transposes rows [i0, i1) and columns [j0, j1) of A. Split points are kept
+// on multiples of LEAF, so leaves start on block boundaries; within a leaf,
+// the diagonal element of each row is copied last, as in trans32().
+void trans_region(int M, int N, int A[N][M], int B[M][N], int i0, int i1, int j0, int j1)
+{
+	int i, j, mid, diag;
+
+	if (i1 - i0 <= LEAF && j1 - j0 <= LEAF) {
+		for (i = i0; i < i1; ++i) {
+			diag = 0;
+			for (j = j0; j < j1; ++j) {
+				if (i == j) {
+					diag = 1;
+				} else {
+					TRANS_STORE(B, j, i, TRANS_LOAD(A, i, j));
+				}
+			}
+			if (diag) {
+				TRANS_STORE(B, i, i, TRANS_LOAD(A, i, i));
+			}
+		}
+	} else if (i1 - i0 >= j1 - j0) {
+		mid = i0 + ((i1 - i0) / 2 + LEAF - 1) / LEAF * LEAF;
+		trans_region(M, N, A, B, i0, mid, j0, j1);
+		trans_region(M, N, A, B, mid, i1, j0, j1);
+	} else {
+		mid = j0 + ((j1 - j0) / 2 + LEAF - 1) / LEAF * LEAF;
+		trans_region(M, N, A, B, i0, i1, j0, mid);
+		trans_region(M, N, A, B, i0, i1, mid, j1);
+	}
+}
+
+#ifdef __x86_64__
+// In-register micro-kernels: each transposes one tile of ints from a (rows
+// lda ints apart) into b (rows ldb ints apart). Every 128-bit lane gets a
+// 4x4 transpose from unpacklo/hi_epi32 and _epi64; the wider kernels then
+// exchange lanes between registers. TRANS_TOUCH() records each vector
+// access for test-trans -c.
+__attribute__((target("sse2")))
+void simd4x4(int *a, int lda, int *b, int ldb)
+{
+	__m128i r[4], t[4];
+	int k;
+
+	for (k = 0; k < 4; ++k) {
+		TRANS_TOUCH(a + k*lda, 16, 'L');
+		r[k] = _mm_loadu_si128((__m128i *) (a + k*lda));
+	}
+	t[0] = _mm_unpacklo_epi32(r[0], r[1]);
+	t[1] = _mm_unpackhi_epi32(r[0], r[1]);
+	t[2] = _mm_unpacklo_epi32(r[2], r[3]);
+	t[3] = _mm_unpackhi_epi32(r[2], r[3]);
+	r[0] = _mm_unpacklo_epi64(t[0], t[2]);
+	r[1] = _mm_unpackhi_epi64(t[0], t[2]);
+	r[2] = _mm_unpacklo_epi64(t[1], t[3]);
+	r[3] = _mm_unpackhi_epi64(t[1], t[3]);
+	for (k = 0; k < 4; ++k) {
+		TRANS_TOUCH(b + k*ldb, 16, 'S');
+		_mm_storeu_si128((__m128i *) (b + k*ldb), r[k]);
+	}
+}
+
+// Rows 4g..4g+3 become columns within each lane; permute2x128 then pairs the
+// low lanes (columns 0-3) and the high lanes (columns 4-7) of the two groups.
+__attribute__((target("avx2")))
+void simd8x8(int *a, int lda, int *b, int ldb)
+{
+	__m256i r[8], t[8];
+	int k, g;
+
+	for (k = 0; k < 8; ++k) {
+		TRANS_TOUCH(a + k*lda, 32, 'L');
+		r[k] = _mm256_loadu_si256((__m256i *) (a + k*lda));
+	}
+	for (g = 0; g < 8; g += 4) {
+		t[g] = _mm256_unpacklo_epi32(r[g], r[g+1]);
+		t[g+1] = _mm256_unpackhi_epi32(r[g], r[g+1]);
+		t[g+2] = _mm256_unpacklo_epi32(r[g+2], r[g+3]);
+		t[g+3] = _mm256_unpackhi_epi32(r[g+2], r[g+3]);
+		r[g] = _mm256_unpacklo_epi64(t[g], t[g+2]);
+		r[g+1] = _mm256_unpackhi_epi64(t[g], t[g+2]);
+		r[g+2] = _mm256_unpacklo_epi64(t[g+1], t[g+3]);
+		r[g+3] = _mm256_unpackhi_epi64(t[g+1], t[g+3]);
+	}
+	for (k = 0; k < 4; ++k) {
+		t[k] = _mm256_permute2x128_si256(r[k], r[k+4], 0x20);
+		t[k+4] = _mm256_permute2x128_si256(r[k], r[k+4], 0x31);
+	}
+	for (k = 0; k < 8; ++k) {
+		TRANS_TOUCH(b + k*ldb, 32, 'S');
+		_mm256_storeu_si256((__m256i *) (b + k*ldb), t[k]);
+	}
+}
+
+// As simd8x8() over four groups of rows, with two rounds of shuffle_i32x4:
+// 0x88 gathers lanes 0 and 2 of both sources, 0xdd lanes 1 and 3.
+__attribute__((target("avx512f")))
+void simd16x16(int *a, int lda, int *b, int ldb)
+{
+	__m512i r[16], t[16];
+	int k, g;
+
+	for (k = 0; k < 16; ++k) {
+		TRANS_TOUCH(a + k*lda, 64, 'L');
+		r[k] = _mm512_loadu_si512(a + k*lda);
+	}
+	for (g = 0; g < 16; g += 4) {
+		t[g] = _mm512_unpacklo_epi32(r[g], r[g+1]);
+		t[g+1] = _mm512_unpackhi_epi32(r[g], r[g+1]);
+		t[g+2] = _mm512_unpacklo_epi32(r[g+2], r[g+3]);
+		t[g+3] = _mm512_unpackhi_epi32(r[g+2], r[g+3]);
+		r[g] = _mm512_unpacklo_epi64(t[g], t[g+2]);
+		r[g+1] = _mm512_unpackhi_epi64(t[g], t[g+2]);
+		r[g+2] = _mm512_unpacklo_epi64(t[g+1], t[g+3]);
+		r[g+3] = _mm512_unpackhi_epi64(t[g+1], t[g+3]);
+	}
+	for (k = 0; k < 4; ++k) {
+		t[k] = _mm512_shuffle_i32x4(r[k], r[k+4], 0x88);
+		t[k+4] = _mm512_shuffle_i32x4(r[k], r[k+4], 0xdd);
+		t[k+8] = _mm512_shuffle_i32x4(r[k+8], r[k+12], 0x88);
+		t[k+12] = _mm512_shuffle_i32x4(r[k+8], r[k+12], 0xdd);
+	}
+	for (k = 0; k < 8; ++k) {
+		r[k] = _mm512_shuffle_i32x4(t[k], t[k+8], 0x88);
+		r[k+8] = _mm512_shuffle_i32x4(t[k], t[k+8], 0xdd);
+	}
+	for (k = 0; k < 16; ++k) {
+		TRANS_TOUCH(b + k*ldb, 64, 'S');
+		_mm512_storeu_si512(b + k*ldb, r[k]);
+	}
+}
+#endif
+
+// Micro-kernel and tile side trans_simd() uses, NULL and 0 until
+// simd_select() has run
+void (*simd_kernel)(int *, int, int *, int);
+int simd_tile;
+
+// Transposes any M x N matrix with the widest micro-kernel the CPU runs,
+// picked at runtime; the description names it.
+char trans_simd_desc[64] = "SIMD blocked transpose";
+void trans_simd(int M, int N, int A[N][M], int B[M][N])
+{
+	if (simd_tile == 0) {
+		simd_select();
+	}
+	if (simd_kernel) {
+		trans_tiled(M, N, A, B, simd_tile, simd_kernel);
+	} else {
+		trans_blocked(M, N, A, B);
+	}
+}
+
+// Picks the kernel from CPUID, through __builtin_cpu_supports(). Setting
+// TRANS_SIMD to avx512, avx2, sse2 or scalar caps the choice, to compare the
+// kernels on one machine; scalar, or a CPU without SSE2, uses trans_blocked().
+void simd_select(void)
+{
+	char *cap = getenv("TRANS_SIMD");
+	int level = 3;
+	char *name = "scalar";
+
+	if (cap) {
+		level = !strcmp(cap, "scalar") ? 0 : !strcmp(cap, "sse2") ? 1 :
+			!strcmp(cap, "avx2") ? 2 : 3;
+	}
+	simd_kernel = NULL;
+	simd_tile = 1;
+#ifdef __x86_64__
+	__builtin_cpu_init();
+	if (level >= 3 && __builtin_cpu_supports("avx512f")) {
+		simd_kernel = simd16x16;
+		simd_tile = 16;
+		name = "avx512f 16x16";
+	} else if (level >= 2 && __builtin_cpu_supports("avx2")) {
+		simd_kernel = simd8x8;
+		simd_tile = 8;
+		name = "avx2 8x8";
+	} else if (level >= 1 && __builtin_cpu_supports("sse2")) {
+		simd_kernel = simd4x4;
+		simd_tile = 4;
+		name = "sse2 4x4";
+	}
+#endif
+	snprintf(trans_simd_desc, sizeof(trans_simd_desc), "SIMD blocked transpose, %s", name);
+}
+
+// Applies kernel to every whole T x T tile, SIMD_BLOCK x SIMD_BLOCK elements
+// at a time, then copies the rows and columns left at the edges one by one.
+void trans_tiled(int M, int N, int A[N][M], int B[M][N], int T, void (*kernel)(int *, int, int *, int))
+{
+	int i, j, ii, jj;
+	int rows = N / T * T, cols = M / T * T;
+
+	for (ii = 0; ii < rows; ii += SIMD_BLOCK) {
+		for (jj = 0; jj < cols; jj += SIMD_BLOCK) {
+			for (i = ii; i < ii+SIMD_BLOCK && i < rows; i += T) {
+				for (j = jj; j < jj+SIMD_BLOCK && j < cols; j += T) {
+					kernel(&A[i][j], M, &B[j][i], N);
+				}
+			}
+		}
+	}
+	for (i = 0; i < N; ++i) {
+		for (j = i < rows ? cols : 0; j < M; ++j) {
+			TRANS_STORE(B, j, i, TRANS_LOAD(A, i, j));
+		}
 	}
 }
 
@@ -126,6 +391,19 @@ void registerFunctions()
 {
     /* Register your solution function */
     registerTransFunction(transpose_submit, transpose_submit_desc); 
+
+#ifdef TRANS_EXTRAS
+    /* Only trans-bench is built with -DTRANS_EXTRAS; test-trans and the
+       driver evaluate the submission alone */
+
+    /* Baselines for shapes without a dedicated kernel */
+    registerTransFunction(trans_blocked, trans_blocked_desc); 
+    registerTransFunction(trans_recursive, trans_recursive_desc); 
+
+    /* Vectorized, for wall-clock speed on large matrices */
+    simd_select();
+    registerTransFunction(trans_simd, trans_simd_desc); 
+#endif
 }
 
 /* 